@@ -11,15 +11,28 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <spawn.h>
+#include <cstddef>
+#include <time.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
 
 using namespace std;
 
+extern char **environ;
+
 #if 0
 #define FUNC_ENTRY()  \
-  cout << __PRETTY_FUNCTION__ << " --> " << endl;
+  cout << __PRETTY_FUNCTION__ << " --> " << '\n';
 
 #define FUNC_EXIT()  \
-  cout << __PRETTY_FUNCTION__ << " <-- " << endl;
+  cout << __PRETTY_FUNCTION__ << " <-- " << '\n';
 #else
 #define FUNC_ENTRY()
 #define FUNC_EXIT()
@@ -30,39 +43,61 @@ using namespace std;
 // ***********************************************************************************************************************************
 
 JobEntry *JobsList::getJobById(int jobId) {
-    for (auto &job : job_list) {
-        if (job.job_id == jobId)
-            return &job;
-    }
-    return nullptr;
+    auto it = job_list.find(jobId);
+    return (it == job_list.end()) ? nullptr : &it->second;
 }
 
 JobEntry *JobsList::getJobByPId(int jobPId) {
-    for (auto &job : job_list) {
-        if (job.process_id == jobPId)
-            return &job;
-    }
-    return nullptr;
+    auto it = pid_to_job_id.find(jobPId);
+    return (it == pid_to_job_id.end()) ? nullptr : getJobById(it->second);
 }
 
 void JobsList::removeJobById(int jobId) {
-    unsigned int pos;
-    if (job_list.empty())
+    auto it = job_list.find(jobId);
+    if (it == job_list.end())
         return;
-    for (pos = 0; pos < job_list.size(); pos++) {
-        if (job_list[pos].job_id == jobId) break;
+    pid_to_job_id.erase(it->second.process_id);
+    stopped_job_ids.erase(jobId);
+    if (it->second.pidfd != -1)
+        close(it->second.pidfd);
+    // the output stays readable with joblog for a while after the job is gone.
+    OutputRing *output = it->second.output;
+    if (output != nullptr) {
+        if (output->fd != -1)
+            SmallShell::getInstance().event_loop.unwatchOutput(output->fd);
+        output->close();
+        finished_outputs.push_back({jobId, output});
+        if (finished_outputs.size() > FINISHED_OUTPUTS_MAX) {
+            delete finished_outputs.front().second;
+            finished_outputs.pop_front();
+        }
+    }
+    job_list.erase(it);
+}
+
+OutputRing *JobsList::getOutput(int jobId) {
+    JobEntry *job = getJobById(jobId);
+    if (job != nullptr)
+        return job->output;
+    for (auto &finished : finished_outputs) {
+        if (finished.first == jobId)
+            return finished.second;
     }
-    job_list.erase(job_list.begin() + pos);
+    return nullptr;
+}
+
+JobsList::~JobsList() {
+    for (auto &it : job_list)
+        delete it.second.output;
+    for (auto &finished : finished_outputs)
+        delete finished.second;
 }
 
 void JobsList::removeJobByPId(int jobPId) {
-    unsigned int pos;
-    if (job_list.empty())
+    auto it = pid_to_job_id.find(jobPId);
+    if (it == pid_to_job_id.end())
         return;
-    for (pos = 0; pos < job_list.size(); pos++) {
-        if (job_list[pos].process_id == jobPId) break;
-    }
-    job_list.erase(job_list.begin() + pos);
+    removeJobById(it->second);
 }
 
 void JobsList::addJob(Command *cmd, int process_id, bool is_stopped) {
@@ -74,50 +109,51 @@ void JobsList::addJob(Command *cmd, int process_id, bool is_stopped) {
         new_id = 1;
     else
         new_id = SmallShell::getInstance().max_job_id + 1;
+    // a new job with the id of a finished one does not show its output.
+    for (auto finished = finished_outputs.begin(); finished != finished_outputs.end(); ++finished) {
+        if (finished->first == new_id) {
+            delete finished->second;
+            finished_outputs.erase(finished);
+            break;
+        }
+    }
     JobEntry current_job(new_id, process_id, job_command, start_time, is_stopped, false);
-    job_list.push_back(current_job);
-    SmallShell::getInstance().max_job_id++;
+    current_job.placement = cmd->placement;
+    current_job.limits = cmd->limits;
+#ifdef SYS_pidfd_open
+    // kernels without pidfds (before 5.3) fall back to plain pids.
+    current_job.pidfd = syscall(SYS_pidfd_open, process_id, 0);
+#endif
+    job_list.emplace_hint(job_list.end(), new_id, current_job);
+    pid_to_job_id[process_id] = new_id;
+    if (is_stopped)
+        stopped_job_ids.insert(new_id);
     update_max_id();
 }
 
-bool JobsComparor(const JobEntry &first, const JobEntry &second) {
-    return (first.job_id < second.job_id);
+void JobsList::setStopped(JobEntry *job, bool is_stopped) {
+    job->is_stopped = is_stopped;
+    if (is_stopped)
+        stopped_job_ids.insert(job->job_id);
+    else
+        stopped_job_ids.erase(job->job_id);
 }
 
 JobEntry *JobsList::getMaxJob() {
-    std::sort(job_list.begin(), job_list.end(), JobsComparor);
-    return &job_list.back();
+    if (job_list.empty())
+        return nullptr;
+    return &job_list.rbegin()->second;
 }
 
+// the last stopped job is the stopped job with the maximal job id.
 JobEntry *JobsList::getLastStoppedJob() {
-    int job_id;
-    for (auto &it : job_list) {
-        if (it.is_stopped) {
-            job_id = it.job_id;
-            break;
-        }
-    }
-    return getJobById(job_id);
+    if (stopped_job_ids.empty())
+        return nullptr;
+    return getJobById(*stopped_job_ids.rbegin());
 }
 
 void JobsList::update_max_id() {
-    int cur_max = 1;
-    for (auto &it : job_list) {
-        if (it.job_id > cur_max)
-            cur_max = it.job_id;
-    }
-    SmallShell::getInstance().max_job_id = cur_max;
-}
-
-void JobsList::removeFinishedJobs() {
-    if (job_list.empty()) return;
-    int wait_res = waitpid(-1, nullptr, WNOHANG);
-    // the problem with timeout not in job list is here !!!!!!!!!!!!!!!!!!!
-    while (wait_res > 0) {
-        removeJobByPId(wait_res);
-        wait_res = waitpid(-1, nullptr, WNOHANG);
-    }
-    update_max_id();
+    SmallShell::getInstance().max_job_id = job_list.empty() ? 1 : job_list.rbegin()->first;
 }
 
 int JobEntry::calc_job_elapsed_time() const {
@@ -125,556 +161,3169 @@ int JobEntry::calc_job_elapsed_time() const {
     return (int) difftime(time(timer), start_time);
 }
 
+int JobEntry::sendSignal(int signum) const {
+    int result;
+#ifdef SYS_pidfd_send_signal
+    if (pidfd != -1)
+        result = syscall(SYS_pidfd_send_signal, pidfd, signum, nullptr, 0);
+    else
+#endif
+        result = kill(process_id, signum);
+    // every process of a pipeline job is in the group its first one leads. smash has not reaped that one yet, so its
+    // pid, and with it the group, is still the job's.
+    if (result == 0)
+        killpg(process_id, signum);
+    return result;
+}
+
 void JobEntry::continue_job() {
-    if (kill(process_id, SIGCONT) == -1)
-        perror("smash error: kill failed");
+    if (sendSignal(SIGCONT) == -1)
+        smashPerror("smash error: kill failed");
     else
-        is_stopped = false;
+        SmallShell::getInstance().jobs.setStopped(this, false);
+}
+
+void OutputRing::append(const char *data, size_t length) {
+    total += length;
+    size_t capacity = buffer.size();
+    // only the tail of a write bigger than the whole ring can be kept.
+    if (length > capacity) {
+        data += length - capacity;
+        length = capacity;
+    }
+    size_t end = (start + size) % capacity;
+    size_t first_part = min(length, capacity - end);
+    memcpy(buffer.data() + end, data, first_part);
+    memcpy(buffer.data(), data + first_part, length - first_part);
+    size += length;
+    if (size > capacity) {
+        start = (start + size - capacity) % capacity;
+        size = capacity;
+    }
+}
+
+bool OutputRing::drain() {
+    if (fd == -1)
+        return false;
+    char chunk[BUFFER_SIZE];
+    while (true) {
+        ssize_t input_read = read(fd, chunk, sizeof(chunk));
+        if (input_read > 0) {
+            append(chunk, input_read);
+            continue;
+        }
+        if (input_read == -1 && errno == EINTR)
+            continue;
+        // EAGAIN - the job has not written anything more yet.
+        return input_read == -1 && errno == EAGAIN;
+    }
+}
+
+void OutputRing::close() {
+    if (fd == -1)
+        return;
+    drain();
+    ::close(fd);
+    fd = -1;
+}
+
+string OutputRing::tail(unsigned int lines) const {
+    string text;
+    text.reserve(size);
+    size_t first_part = min(size, buffer.size() - start);
+    text.append(buffer.data() + start, first_part);
+    text.append(buffer.data(), size - first_part);
+    if (lines == 0)
+        return text;
+    // a last line without a newline still counts as a line.
+    size_t pos = text.size();
+    if (pos > 0 && text[pos - 1] == '\n')
+        pos--;
+    while (lines > 0 && pos > 0) {
+        size_t newline = text.rfind('\n', pos - 1);
+        if (newline == string::npos) {
+            pos = 0;
+            break;
+        }
+        pos = newline;
+        lines--;
+    }
+    return (lines == 0) ? text.substr(pos + 1) : text;
 }
 
 // ***********************************************************************************************************************************
-// **********************************                STRING FUNCTIONS                 ************************************************
+// **********************************                FUNCTIONS FOR TIMEOUTS             **********************************************
 // ***********************************************************************************************************************************
 
-string left_trim(const string &s) {
-    size_t start = s.find_first_not_of(WHITESPACE);
-    return (start == string::npos) ? "" : s.substr(start);
+long long TimeOutList::now() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
-string right_trim(const string &s) {
-    size_t end = s.find_last_not_of(WHITESPACE);
-    return (end == string::npos) ? "" : s.substr(0, end + 1);
+void TimeOutList::swapEntries(unsigned int first, unsigned int second) {
+    std::swap(timeout_list[first], timeout_list[second]);
+    pid_to_index[timeout_list[first].pid] = first;
+    pid_to_index[timeout_list[second].pid] = second;
 }
 
-string both_trim(const string &s) {
-    return right_trim(left_trim(s));
+void TimeOutList::siftUp(unsigned int pos) {
+    while (pos > 0) {
+        unsigned int parent = (pos - 1) / 2;
+        if (timeout_list[parent].kill_time <= timeout_list[pos].kill_time)
+            return;
+        swapEntries(parent, pos);
+        pos = parent;
+    }
 }
 
-int parseCommandLine(const string &cmd_line, vector<string> &args) {
-    FUNC_ENTRY()
-    string buf;
-    stringstream ss(both_trim(cmd_line));
-    vector<std::string> tokens;
-    while (ss >> buf)
-        args.push_back(buf);
-    return args.size();
-    FUNC_EXIT()
+void TimeOutList::siftDown(unsigned int pos) {
+    while (true) {
+        unsigned int smallest = pos, left = 2 * pos + 1, right = 2 * pos + 2;
+        if (left < timeout_list.size() && timeout_list[left].kill_time < timeout_list[smallest].kill_time)
+            smallest = left;
+        if (right < timeout_list.size() && timeout_list[right].kill_time < timeout_list[smallest].kill_time)
+            smallest = right;
+        if (smallest == pos)
+            return;
+        swapEntries(smallest, pos);
+        pos = smallest;
+    }
 }
 
-bool isBackgroundCommand(string &cmd_line) {
-    return cmd_line[cmd_line.find_last_not_of(WHITESPACE)] == '&';
+int TimeOutList::timerFd() {
+    if (timer_fd == -1 && (timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+        smashPerror("smash error: timerfd_create failed");
+    return timer_fd;
 }
 
-void BuiltInCommand::remove_background_sign(string &cmd_line) {
-    int i;
-    bool to_remove = false;
-    for (i = cmd_line.size() - 1; i >= 0; i--) {
-        if (cmd_line[i] == '&') {
-            to_remove = true;
-            break;
-        }
-    }
-    if (to_remove)
-        cmd_line.erase(i);
+void TimeOutList::reset() {
+    timeout_list.clear();
+    pid_to_index.clear();
+    if (timer_fd != -1)
+        close(timer_fd);
+    timer_fd = -1;
+}
 
+// sets the timer to the earliest deadline, or disarms it when nothing is pending.
+void TimeOutList::rearm() {
+    if (timerFd() == -1)
+        return;
+    struct itimerspec spec {};
+    if (!timeout_list.empty()) {
+        spec.it_value.tv_sec = timeout_list[0].kill_time / 1000000000LL;
+        spec.it_value.tv_nsec = timeout_list[0].kill_time % 1000000000LL;
+    }
+    // an absolute deadline which has already passed fires right away.
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1)
+        smashPerror("smash error: timerfd_settime failed");
 }
 
-// redirection >
-bool checkFirstRedirection(const string &cmd_line) {
-    return (cmd_line.find('>') != string::npos) && (cmd_line.find(">>") == string::npos);
+void TimeOutList::add_entry(const string &cmd_line, const string &un_proccessed_cmd, int pid, long long duration,
+                            bool is_timeout_bg) {
+    // a pid can only have one timeout.
+    remove_entry(pid);
+    timeout_list.emplace_back(cmd_line, un_proccessed_cmd, pid, duration, now(), is_timeout_bg);
+    pid_to_index[pid] = timeout_list.size() - 1;
+    siftUp(timeout_list.size() - 1);
+    if (pid_to_index[pid] == 0)
+        rearm();
 }
 
-// redirection >>
-bool checkSecondRedirection(const string &cmd_line) {
-    return (cmd_line.find(">>") != string::npos);
+void TimeOutList::removeAt(unsigned int pos) {
+    unsigned int last = timeout_list.size() - 1;
+    if (pos != last)
+        swapEntries(pos, last);
+    pid_to_index.erase(timeout_list[last].pid);
+    timeout_list.pop_back();
+    if (pos < timeout_list.size()) {
+        siftUp(pos);
+        siftDown(pos);
+    }
+    if (pos == 0)
+        rearm();
 }
 
-// pipe |
-bool checkFirstPipe(const string &cmd_line) {
-    return (cmd_line.find('|') != string::npos) && (cmd_line.find("|&") == string::npos);
+void TimeOutList::remove_entry(int pid) {
+    auto it = pid_to_index.find(pid);
+    if (it == pid_to_index.end())
+        return;
+    removeAt(it->second);
 }
 
-// pipe |&
-bool checkSecondPipe(string &cmd_line) {
-    return (cmd_line.find("|&") != string::npos);
+void TimeOutList::extend_entry(int pid, long long delta) {
+    auto it = pid_to_index.find(pid);
+    if (it == pid_to_index.end())
+        return;
+    unsigned int pos = it->second;
+    timeout_list[pos].kill_time += delta;
+    timeout_list[pos].duration += delta;
+    siftUp(pos);
+    siftDown(pos);
+    rearm();
 }
 
-Command *SmallShell::CreateCommand(string &cmd_line) {
+TimeOutList::TimeOutEntry *TimeOutList::getTimeOutByPid(int pid) {
+    auto it = pid_to_index.find(pid);
+    return (it == pid_to_index.end()) ? nullptr : &timeout_list[it->second];
+}
 
-    string firstWord = both_trim(cmd_line.substr(0, cmd_line.find_first_of(" \n")));
-    // **************       SPECIAL COMMANDS       **************
-    if (checkFirstRedirection(cmd_line))
-        return new RedirectionCommand(cmd_line, true, false);
-    else if (checkSecondRedirection(cmd_line))
-        return new RedirectionCommand(cmd_line, false, true);
-    else if (checkFirstPipe(cmd_line))
-        return new PipeCommand(cmd_line, true, false);
-    else if (checkSecondPipe(cmd_line))
-        return new PipeCommand(cmd_line, false, true);
-        // **************       BUILT IN COMMANDS       **************
-    else if (firstWord == "pwd" || firstWord == "pwd&")
-        return new GetCurrDirCommand(cmd_line);
-    else if (firstWord == "showpid" || firstWord == "showpid&")
-        return new ShowPidCommand(cmd_line);
-    else if (firstWord == "jobs" || firstWord == "jobs&")
-        return new JobsCommand(cmd_line, &jobs);
-    else if (firstWord == "chprompt" || firstWord == "chprompt&")
-        return new ChangePromptCommand(cmd_line);
-    else if (firstWord == "cd" || firstWord == "cd&")
-        return new ChangeDirCommand(cmd_line);
-    else if (firstWord == "kill" || firstWord == "kill&")
-        return new KillCommand(cmd_line, &jobs);
-    else if (firstWord == "fg" || firstWord == "fg&")
-        return new ForegroundCommand(cmd_line, &jobs);
-    else if (firstWord == "bg" || firstWord == "bg&")
-        return new BackgroundCommand(cmd_line, &jobs);
-    else if (firstWord == "quit" || firstWord == "quit&")
-        return new QuitCommand(cmd_line, &jobs);
-    else if (firstWord == "cat" || firstWord == "cat&")
-        return new CatCommand(cmd_line);
-        // **************       EXTERNAL COMMANDS       **************
-    else if (firstWord == "timeout")
-        return new TimeOutCommand(cmd_line);
-    else
-        return new ExternalCommand(cmd_line);
-    return nullptr;
+TimeOutList::TimeOutEntry *TimeOutList::top() {
+    return timeout_list.empty() ? nullptr : &timeout_list[0];
 }
 
-void SmallShell::executeCommand(string &cmd_line) {
-    jobs.removeFinishedJobs();
-    jobs.update_max_id();
-    Command *cmd = CreateCommand(cmd_line);
-    cmd->un_proccessed_cmd = cmd_line;
-    cmd->execute();
-    delete cmd;
+void TimeOutList::pop() {
+    if (!timeout_list.empty())
+        removeAt(0);
 }
 
 // ***********************************************************************************************************************************
-// **********************************                BUILT IN EXECUTE                 ************************************************
+// **********************************                FUNCTIONS FOR PATH CACHE           **********************************************
 // ***********************************************************************************************************************************
 
-void ChangePromptCommand::execute() {
-    vector<string> args;
-    if (parseCommandLine(cmd_line, args) == 1 || args[1] == "&")
-        SmallShell::getInstance().prompt = "smash> ";
-    else {
-        SmallShell::getInstance().prompt = args[1] + "> ";
+bool PathCache::searchPath(const string &command, string &full_path) const {
+    size_t start = 0;
+    while (start <= cached_path_env.size()) {
+        size_t end = cached_path_env.find(':', start);
+        if (end == string::npos)
+            end = cached_path_env.size();
+        // an empty PATH element means the current directory.
+        string dir = (end == start) ? "." : cached_path_env.substr(start, end - start);
+        string candidate = dir + "/" + command;
+        struct stat file_stat {};
+        if (stat(candidate.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+            access(candidate.c_str(), X_OK) == 0) {
+            full_path = candidate;
+            return true;
+        }
+        start = end + 1;
     }
+    return false;
 }
 
-void ShowPidCommand::execute() {
-    int ret_pid = 0;
-    SYS_CALL(ret_pid, getpid());
-    cout << "smash pid is " << ret_pid << endl;
+bool PathCache::resolve(const string &command, string &full_path) {
+    // a command with a slash is never looked up in PATH.
+    if (command.find('/') != string::npos) {
+        full_path = command;
+        return true;
+    }
+    const char *path_env = getenv("PATH");
+    string current_path_env = path_env ? path_env : "";
+    // PATH has changed since the entries were resolved, so none of them can be trusted.
+    if (current_path_env != cached_path_env) {
+        flush();
+        cached_path_env = current_path_env;
+    }
+    auto it = entries.find(command);
+    if (it == entries.end()) {
+        string found_path;
+        if (!searchPath(command, found_path))
+            return false;
+        it = entries.emplace(command, PathEntry(found_path)).first;
+    }
+    it->second.hits++;
+    full_path = it->second.path;
+    return true;
 }
 
-void GetCurrDirCommand::execute() {
-    char current_pwd[PATH_MAX_CD];
-    if (getcwd(current_pwd, PATH_MAX_CD) != nullptr)
-        cout << current_pwd << endl;
-    else
-        perror("smash error: pwd failed");
+bool PathCache::insert(const string &command) {
+    string full_path;
+    if (!resolve(command, full_path))
+        return false;
+    auto it = entries.find(command);
+    // resolve counts a hit, but hashing a command by hand is not a use of it.
+    if (it != entries.end())
+        it->second.hits--;
+    return true;
 }
 
-void ChangeDirCommand::execute() {
-    SmallShell &smash = SmallShell::getInstance();
-    vector<string> args;
-    int return_val;
-    int num_of_args = parseCommandLine(cmd_line, args);
+void PathCache::remove(const string &command) {
+    entries.erase(command);
+}
 
-    // too many args.
-    if (num_of_args >= 3) {
-        perror("smash error: cd: too many arguments");
-        return;
-    }
-    // no args - do nothing.
-    if (num_of_args == 1)
-        return;
-    // change to specific dir.
-    if (args[1] != "-") {
-        char current_pwd[PATH_MAX_CD];
-        getcwd(current_pwd, PATH_MAX_CD);
-        SYS_CALL(return_val, chdir(args[1].c_str()));
-        smash.prev_wd = string(current_pwd);
-        // change to prev dir.
+void PathCache::flush() {
+    entries.clear();
+}
+
+// ***********************************************************************************************************************************
+// **********************************                FUNCTIONS FOR LAUNCHER             **********************************************
+// ***********************************************************************************************************************************
+
+Launcher::Launcher() : backend(LAUNCH_SPAWN) {
+    // the backend can be chosen before smash starts, which is handy for benchmarking the two.
+    const char *env_backend = getenv("SMASH_LAUNCHER");
+    if (env_backend != nullptr && string(env_backend) == "fork")
+        backend = LAUNCH_FORK;
+}
+
+const char *Launcher::backendName(LaunchBackend backend) {
+    return (backend == LAUNCH_FORK) ? "fork" : "spawn";
+}
+
+int Launcher::launch(const LaunchSpec &spec) {
+    // what smash printed so far comes before anything the child prints.
+    cout.flush();
+    // argv is built before creating the child, so the child itself only does syscalls.
+    vector<char *> argv;
+    if (!spec.argv.empty()) {
+        for (const char *arg : spec.argv)
+            argv.push_back(const_cast<char *>(arg));
     } else {
-        if (smash.prev_wd.empty()) {
-            perror("smash error: cd: OLDPWD not set");
-            return;
-        } else {
-            char current_pwd[PATH_MAX_CD];
-            getcwd(current_pwd, PATH_MAX_CD);
-            SYS_CALL(return_val, chdir(smash.prev_wd.c_str()));
-            smash.prev_wd = string(current_pwd);
-        }
+        for (auto &arg : spec.args)
+            argv.push_back(const_cast<char *>(arg.c_str()));
     }
+    argv.push_back(nullptr);
+    int pid;
+    if (backend == LAUNCH_SPAWN && !spec.placement.isSet() && !spec.limits.isSet())
+        pid = launchSpawn(spec, argv);
+    else
+        pid = launchFork(spec, argv);
+    // the child has its own copies by now.
+    for (int fd : spec.owned_fds)
+        close(fd);
+    return pid;
 }
 
-void JobsCommand::execute() {
-    if (jobs_list->job_list.empty())
-        return;
-    std::sort(jobs_list->job_list.begin(), jobs_list->job_list.end(), JobsComparor);
-    for (auto &job : jobs_list->job_list) {
-        if (job.is_stopped)
-            cout << "[" << job.job_id << "]" << job.job_command << " : " << job.process_id << " "
-                 << job.calc_job_elapsed_time() << " secs (stopped)" << endl;
-        else if (!job.is_finished)
-            cout << "[" << job.job_id << "]" << job.job_command << " : " << job.process_id << " " <<
-                 job.calc_job_elapsed_time() << " secs" << endl;
+int Launcher::launchFork(const LaunchSpec &spec, vector<char *> &argv) {
+    int pid = fork();
+    if (pid < 0) {
+        smashPerror("smash error: fork failed");
+        return -1;
     }
+    if (pid == 0) {
+        sigset_t handled_signals = EventLoop::handledSignals();
+        sigprocmask(SIG_UNBLOCK, &handled_signals, nullptr);
+        setpgid(0, spec.process_group);
+        for (auto &fds : spec.dup_fds) {
+            if (dup2(fds.first, fds.second) == -1) {
+                smashPerror("smash error: dup2 failed");
+                _exit(1);
+            }
+        }
+        if (!applyFdActions(spec.fd_actions))
+            _exit(1);
+        for (int fd : spec.close_fds)
+            close(fd);
+        // a child which can not have its placement or limits exits before exec, so nothing half applied runs.
+        const char *failed_call = spec.placement.apply(0);
+        if (failed_call != nullptr) {
+            smashPerror((string("smash error: ") + failed_call + " failed").c_str());
+            _exit(1);
+        }
+        if (!spec.limits.apply(0)) {
+            smashPerror("smash error: prlimit failed");
+            _exit(1);
+        }
+        execv(spec.path.c_str(), argv.data());
+        smashPerror("smash error: execv failed");
+        _exit(1);
+    }
+    return pid;
 }
 
-void KillCommand::execute() {
-    vector<string> args;
-    int num_of_args = parseCommandLine(cmd_line, args);
+bool Launcher::applyFdActions(const vector<FdAction> &actions) {
+    for (const FdAction &action : actions) {
+        if (action.path == nullptr) {
+            if (dup2(action.source_fd, action.fd) == -1) {
+                smashPerror("smash error: dup2 failed");
+                return false;
+            }
+            continue;
+        }
+        int fd = open(action.path, action.flags, REDIRECT_MODE);
+        if (fd == -1) {
+            smashPerror("smash error: open failed");
+            return false;
+        }
+        if (fd != action.fd) {
+            if (dup2(fd, action.fd) == -1) {
+                smashPerror("smash error: dup2 failed");
+                return false;
+            }
+            close(fd);
+        }
+    }
+    return true;
+}
 
-    if (num_of_args != 3 || args[1][0] != '-') {
-        perror("smash error: kill: invalid arguments");
-        return;
+// posix_spawn creates the child with clone(CLONE_VM | CLONE_VFORK), so no page tables are copied no matter how big smash is.
+int Launcher::launchSpawn(const LaunchSpec &spec, vector<char *> &argv) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t file_actions;
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&file_actions);
+    // smash keeps its signals blocked for the signalfd, the child gets a clean mask.
+    sigset_t empty_mask;
+    sigemptyset(&empty_mask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, spec.process_group);
+    posix_spawnattr_setsigmask(&attr, &empty_mask);
+    for (auto &fds : spec.dup_fds)
+        posix_spawn_file_actions_adddup2(&file_actions, fds.first, fds.second);
+    for (const FdAction &action : spec.fd_actions) {
+        if (action.path == nullptr)
+            posix_spawn_file_actions_adddup2(&file_actions, action.source_fd, action.fd);
+        else
+            posix_spawn_file_actions_addopen(&file_actions, action.fd, action.path, action.flags, REDIRECT_MODE);
     }
+    for (int fd : spec.close_fds)
+        posix_spawn_file_actions_addclose(&file_actions, fd);
+
+    pid_t pid;
+    int error = posix_spawn(&pid, spec.path.c_str(), &file_actions, &attr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&file_actions);
+    posix_spawnattr_destroy(&attr);
+    if (error != 0) {
+        errno = error;
+        smashPerror("smash error: posix_spawn failed");
+        return -1;
+    }
+    return pid;
+}
 
-    // removes - sign from the first number.
-    args[1].erase(0, 1);
-    bool check_if_second_is_int = (args[1].find_first_not_of("-0123456789") == std::string::npos);
-    bool check_if_third_is_int = (args[2].find_first_not_of("-0123456789") == std::string::npos);
+// ***********************************************************************************************************************************
+// **********************************                FUNCTIONS FOR PLACEMENT            **********************************************
+// ***********************************************************************************************************************************
 
-    // second and third argument must be numbers.
-    if (!check_if_second_is_int || !check_if_third_is_int) {
-        perror("smash error: kill: invalid arguments");
-        return;
+static const char *const IO_CLASS_NAMES[] = {"none", "rt", "be", "idle"};
+
+// a cpu list like 0-3,6.
+static bool parseCpuList(const string &list, cpu_set_t &cpus) {
+    CPU_ZERO(&cpus);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == string::npos)
+            end = list.size();
+        string range = list.substr(start, end - start);
+        size_t dash = range.find('-');
+        string first = range.substr(0, dash), last = (dash == string::npos) ? first : range.substr(dash + 1);
+        if (first.empty() || last.empty() || first.size() > 4 || last.size() > 4 ||
+            (first + last).find_first_not_of("0123456789") != string::npos)
+            return false;
+        int first_cpu = stoi(first), last_cpu = stoi(last);
+        if (first_cpu > last_cpu || last_cpu >= CPU_SETSIZE)
+            return false;
+        for (int cpu = first_cpu; cpu <= last_cpu; cpu++)
+            CPU_SET(cpu, &cpus);
+        start = end + 1;
     }
+    return CPU_COUNT(&cpus) > 0;
+}
 
-    SmallShell &smash = SmallShell::getInstance();
-    int signum = stoi(args[1]);
-    int job_id = stoi(args[2]);
-    JobEntry *job_to_handle;
-
-    if ((job_to_handle = smash.jobs.getJobById(job_id)) == nullptr) {
-        string job_id_error = "smash error: kill: job-id " + args[2] + " does not exist";
-        perror(job_id_error.c_str());
-    } else {
-        // done with error handling. Now execute kill.
-        int return_value;
-        SYS_CALL(return_value, kill(job_to_handle->process_id, signum));
-        cout << "signal number " << args[1] << " was sent to pid " << job_to_handle->process_id << endl;
-        // TODO - should we assign is_stopped if signum == SIGSTOP?
+static string cpuListOf(const cpu_set_t &cpus) {
+    string list;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &cpus))
+            continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &cpus))
+            last++;
+        list += (list.empty() ? "" : ",") + to_string(cpu) + (last > cpu ? "-" + to_string(last) : "");
+        cpu = last;
     }
+    return list;
 }
 
-void ForegroundCommand::execute() {
-    SmallShell &smash = SmallShell::getInstance();
-    JobEntry *job_to_handle = nullptr;
-    vector<string> args;
-    int num_of_args = parseCommandLine(cmd_line, args);
-    int status;
-    // too many arguments.
-    if (num_of_args > 2) {
-        perror("smash error: fg: invalid arguments");
-        return;
-    } else if (num_of_args == 1) {
-        // no arguments but job list is emtpy.
-        if (smash.jobs.job_list.empty()) {
-            perror("smash error: fg: jobs list is empty");
-            return;
+bool Placement::parseOption(const vector<string> &args, int &pos) {
+    if (pos + 1 >= (int) args.size())
+        return false;
+    const string &option = args[pos], &value = args[pos + 1];
+    if (option == "--cpus") {
+        if (!parseCpuList(value, cpus))
+            return false;
+        has_cpus = true;
+    } else if (option == "--nice") {
+        string digits = (value[0] == '-' || value[0] == '+') ? value.substr(1) : value;
+        if (digits.empty() || digits.size() > 2 || digits.find_first_not_of("0123456789") != string::npos)
+            return false;
+        nice = stoi(value);
+        if (nice < -20 || nice > 19)
+            return false;
+        has_nice = true;
+    } else if (option == "--io") {
+        // idle, or be / rt with an optional level (be:7).
+        string io_name = value.substr(0, value.find(':'));
+        int new_class = -1;
+        for (int i = IOPRIO_CLASS_RT; i <= IOPRIO_CLASS_IDLE; i++) {
+            if (io_name == IO_CLASS_NAMES[i])
+                new_class = i;
         }
-            // no arguments so get the maximum job.
-        else {
-            job_to_handle = smash.jobs.getMaxJob();
-            if (job_to_handle->is_stopped)
-                job_to_handle->continue_job();
+        if (new_class == -1)
+            return false;
+        io_level = (new_class == IOPRIO_CLASS_IDLE) ? 0 : IOPRIO_LEVELS / 2;
+        if (value.size() > io_name.size()) {
+            string level = value.substr(io_name.size() + 1);
+            if (new_class == IOPRIO_CLASS_IDLE || level.size() != 1 || level[0] < '0' ||
+                level[0] >= '0' + IOPRIO_LEVELS)
+                return false;
+            io_level = level[0] - '0';
         }
+        io_class = new_class;
+    } else if (option == "--sched") {
+        if (value == "other" || value == "normal")
+            policy = SCHED_OTHER;
+        else if (value == "batch")
+            policy = SCHED_BATCH;
+        else if (value == "idle")
+            policy = SCHED_IDLE;
+        else
+            return false;
+    } else {
+        return false;
     }
-        // specific job handling.
-    else {
-        bool check_if_id_is_num = args[1].find_first_not_of("-0123456789") == std::string::npos;
-        if(!check_if_id_is_num) {
-            perror("smash error: fg: invalid arguments");
-            return;
-        }
+    pos += 2;
+    return true;
+}
 
-        int job_id = stoi(args[1]);
-        job_to_handle = smash.jobs.getJobById(job_id);
-        // specific job does not exists in the list.
-        if (job_to_handle == nullptr) {
-            string error_str = "smash error: fg: job-id " + args[1] + " does not exist";
-            perror(error_str.c_str());
-            return;
-        } else {
-            if (job_to_handle->is_stopped)
-                job_to_handle->continue_job();
-        }
+const char *Placement::apply(int pid) const {
+    // the policy goes first, so the nice value is set under the policy it belongs to.
+    if (policy != -1) {
+        struct sched_param param {};
+        if (sched_setscheduler(pid, policy, &param) == -1)
+            return "sched_setscheduler";
     }
-    smash.current_fg_pid = job_to_handle->process_id;
-    smash.current_fg_job_id = job_to_handle->job_id;
-    smash.curr_fg_command = smash.CreateCommand(job_to_handle->job_command);
-    cout << job_to_handle->job_command + " : " + to_string(job_to_handle->process_id) << endl;
-    // wait until job_to_handled is finished or someone has stopped it (WUNTRACED).
-    if (waitpid(job_to_handle->process_id, &status, WUNTRACED) < 0) {
-        perror("smash error: waitpid failed");
+    if (has_nice && setpriority(PRIO_PROCESS, pid, nice) == -1)
+        return "setpriority";
+    if (has_cpus && sched_setaffinity(pid, sizeof(cpus), &cpus) == -1)
+        return "sched_setaffinity";
+    if (io_class != -1 &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, (io_class << IOPRIO_CLASS_SHIFT) | io_level) == -1)
+        return "ioprio_set";
+    return nullptr;
+}
+
+bool Placement::read(int pid) {
+    if (sched_getaffinity(pid, sizeof(cpus), &cpus) == -1 || (policy = sched_getscheduler(pid)) == -1)
+        return false;
+    has_cpus = true;
+    // -1 is a valid nice value, so only errno tells a failure apart.
+    errno = 0;
+    nice = getpriority(PRIO_PROCESS, pid);
+    if (errno != 0)
+        return false;
+    has_nice = true;
+    long io_priority = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, pid);
+    if (io_priority == -1)
+        return false;
+    io_class = io_priority >> IOPRIO_CLASS_SHIFT;
+    io_level = io_priority & ((1 << IOPRIO_CLASS_SHIFT) - 1);
+    // no class means best-effort, at the level that follows from the nice value.
+    if (io_class == 0) {
+        io_class = IOPRIO_CLASS_BE;
+        io_level = (nice + 20) / 5;
     }
-    if (WIFEXITED(status) || WIFSIGNALED(status)) {
-        smash.jobs.removeJobById(job_to_handle->job_id);
-        smash.current_fg_pid = -1;
-        smash.current_fg_job_id = -1;
+    policy &= ~SCHED_RESET_ON_FORK;
+    return true;
+}
+
+void Placement::merge(const Placement &other) {
+    if (other.has_cpus) {
+        has_cpus = true;
+        cpus = other.cpus;
     }
-    smash.jobs.update_max_id();
+    if (other.has_nice) {
+        has_nice = true;
+        nice = other.nice;
+    }
+    if (other.io_class != -1) {
+        io_class = other.io_class;
+        io_level = other.io_level;
+    }
+    if (other.policy != -1)
+        policy = other.policy;
 }
 
-void BackgroundCommand::execute() {
-    SmallShell &smash = SmallShell::getInstance();
-    vector<string> args;
-    int num_of_args = parseCommandLine(cmd_line, args);
-    JobEntry *job_to_handle;
-    // invalid arguments.
-    if (num_of_args > 2) {
-        perror("smash error: bg: invalid arguments");
-        return;
+string Placement::describe() const {
+    vector<string> parts;
+    if (has_cpus)
+        parts.push_back("cpus " + cpuListOf(cpus));
+    if (has_nice)
+        parts.push_back("nice " + to_string(nice));
+    if (io_class != -1)
+        parts.push_back(string("io ") + IO_CLASS_NAMES[io_class] +
+                        (io_class == IOPRIO_CLASS_IDLE ? "" : ":" + to_string(io_level)));
+    if (policy != -1) {
+        const char *policy_name = (policy == SCHED_BATCH) ? "batch" : (policy == SCHED_IDLE) ? "idle" :
+                                  (policy == SCHED_OTHER) ? "other" : "realtime";
+        parts.push_back(string("sched ") + policy_name);
     }
+    string description;
+    for (auto &part : parts)
+        description += (description.empty() ? "" : " ") + part;
+    return description;
+}
 
-    if (num_of_args == 1) {
-        job_to_handle = smash.jobs.getLastStoppedJob();
-        // jobs list is empty.
-        if (job_to_handle == nullptr) {
-            perror("smash error: bg: there is no stopped jobs to resume");
-            return;
-        }
+// ***********************************************************************************************************************************
+// **********************************                FUNCTIONS FOR LIMITS               **********************************************
+// ***********************************************************************************************************************************
+
+// a number of bytes, with an optional K, M or G suffix.
+static bool parseSize(const string &value, rlim_t &size) {
+    string digits = value;
+    rlim_t unit = 1;
+    if (!digits.empty() && strchr("KMG", toupper(digits.back())) != nullptr) {
+        char suffix = toupper(digits.back());
+        unit = (suffix == 'K') ? 1024 : (suffix == 'M') ? 1024 * 1024 : 1024 * 1024 * 1024;
+        digits.pop_back();
+    }
+    if (digits.empty() || digits.size() > 12 || digits.find_first_not_of("0123456789") != string::npos)
+        return false;
+    size = stoull(digits) * unit;
+    return size > 0;
+}
+
+static string sizeOf(rlim_t size) {
+    const char *suffixes = "KMG";
+    int unit = -1;
+    while (unit < 2 && size % 1024 == 0) {
+        size /= 1024;
+        unit++;
+    }
+    return to_string(size) + (unit == -1 ? "" : string(1, suffixes[unit]));
+}
+
+bool Limits::parseOption(const vector<string> &args, int &pos) {
+    if (pos + 1 >= (int) args.size())
+        return false;
+    const string &option = args[pos], &value = args[pos + 1];
+    bool valid;
+    if (option == "--as")
+        valid = parseSize(value, address_space);
+    else if (option == "--fsize")
+        valid = parseSize(value, file_size);
+    else if (option == "--cpu-time" || option == "--nofile") {
+        valid = !value.empty() && value.size() < 10 && value.find_first_not_of("0123456789") == string::npos &&
+                stoul(value) > 0;
+        if (valid)
+            (option == "--cpu-time" ? cpu_seconds : open_files) = stoul(value);
+    } else
+        valid = false;
+    if (valid)
+        pos += 2;
+    return valid;
+}
+
+// the soft and hard limit both become value, but never above the hard limit pid already has.
+static bool capLimit(int pid, int resource, rlim_t value, rlim_t hard_slack = 0) {
+    struct rlimit limit {};
+    if (prlimit(pid, (__rlimit_resource) resource, nullptr, &limit) == -1)
+        return false;
+    limit.rlim_max = min(limit.rlim_max, value + hard_slack);
+    limit.rlim_cur = min(limit.rlim_max, value);
+    return prlimit(pid, (__rlimit_resource) resource, &limit, nullptr) == 0;
+}
+
+bool Limits::apply(int pid) const {
+    // the cpu limit first sends SIGXCPU, which kills. the hard limit, a second later, kills with SIGKILL a process
+    // which caught it.
+    return (address_space == 0 || capLimit(pid, RLIMIT_AS, address_space)) &&
+           (cpu_seconds == 0 || capLimit(pid, RLIMIT_CPU, cpu_seconds, 1)) &&
+           (open_files == 0 || capLimit(pid, RLIMIT_NOFILE, open_files)) &&
+           (file_size == 0 || capLimit(pid, RLIMIT_FSIZE, file_size));
+}
+
+bool Limits::read(int pid) {
+    rlim_t *values[] = {&address_space, &cpu_seconds, &open_files, &file_size};
+    int resources[] = {RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE, RLIMIT_FSIZE};
+    for (int i = 0; i < 4; i++) {
+        struct rlimit limit {};
+        if (prlimit(pid, (__rlimit_resource) resources[i], nullptr, &limit) == -1)
+            return false;
+        *values[i] = (limit.rlim_cur == RLIM_INFINITY) ? 0 : limit.rlim_cur;
+    }
+    return true;
+}
+
+void Limits::merge(const Limits &other) {
+    if (other.address_space != 0)
+        address_space = other.address_space;
+    if (other.cpu_seconds != 0)
+        cpu_seconds = other.cpu_seconds;
+    if (other.open_files != 0)
+        open_files = other.open_files;
+    if (other.file_size != 0)
+        file_size = other.file_size;
+}
+
+string Limits::describe() const {
+    string description;
+    if (address_space != 0)
+        description += " as " + sizeOf(address_space);
+    if (cpu_seconds != 0)
+        description += " cpu-time " + to_string(cpu_seconds);
+    if (open_files != 0)
+        description += " nofile " + to_string(open_files);
+    if (file_size != 0)
+        description += " fsize " + sizeOf(file_size);
+    return description.empty() ? description : description.substr(1);
+}
+
+string Limits::violation(int status) const {
+    // the cpu time and file size limits kill with a signal of their own. a shell reports its child killed by one as
+    // 128 + the signal, the same as exitCodeOf does.
+    int signum = WIFSIGNALED(status) ? WTERMSIG(status) : (WIFEXITED(status) ? WEXITSTATUS(status) - 128 : 0);
+    if (signum == SIGXCPU && cpu_seconds != 0)
+        return "cpu time limit exceeded";
+    if (signum == SIGXFSZ && file_size != 0)
+        return "file size limit exceeded";
+    // running out of memory or fds is only an error the process gets, which it may fail on for any other reason too.
+    return "";
+}
+
+// ***********************************************************************************************************************************
+// **********************************                FUNCTIONS FOR COMMAND ARENA        **********************************************
+// ***********************************************************************************************************************************
+
+void *CommandArena::allocate(size_t size) {
+    // every command is aligned like anything new would return.
+    size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    if (curr_offset + size > ARENA_BLOCK_SIZE) {
+        curr_block++;
+        curr_offset = 0;
+    }
+    if (curr_block == blocks.size())
+        blocks.push_back(static_cast<char *>(::operator new(ARENA_BLOCK_SIZE)));
+    void *memory = blocks[curr_block] + curr_offset;
+    curr_offset += size;
+    return memory;
+}
+
+void CommandArena::release(const Mark &mark) {
+    while (commands.size() > mark.num_of_commands) {
+        commands.back()->~Command();
+        commands.pop_back();
+    }
+    curr_block = mark.block;
+    curr_offset = mark.offset;
+}
+
+CommandArena::~CommandArena() {
+    release(Mark {0, 0, 0});
+    for (char *block : blocks)
+        ::operator delete(block);
+}
+
+// ***********************************************************************************************************************************
+// **********************************                STRING FUNCTIONS                 ************************************************
+// ***********************************************************************************************************************************
+
+string left_trim(const string &s) {
+    size_t start = s.find_first_not_of(WHITESPACE);
+    return (start == string::npos) ? "" : s.substr(start);
+}
+
+string right_trim(const string &s) {
+    size_t end = s.find_last_not_of(WHITESPACE);
+    return (end == string::npos) ? "" : s.substr(0, end + 1);
+}
+
+string both_trim(const string &s) {
+    return right_trim(left_trim(s));
+}
+
+int parseCommandLine(const string &cmd_line, vector<string> &args) {
+    FUNC_ENTRY()
+    string buf;
+    stringstream ss(both_trim(cmd_line));
+    vector<std::string> tokens;
+    while (ss >> buf)
+        args.push_back(buf);
+    return args.size();
+    FUNC_EXIT()
+}
+
+void BuiltInCommand::remove_background_sign(string &cmd_line) {
+    int i;
+    bool to_remove = false;
+    for (i = cmd_line.size() - 1; i >= 0; i--) {
+        if (cmd_line[i] == '&') {
+            to_remove = true;
+            break;
+        }
+    }
+    if (to_remove)
+        cmd_line.erase(i);
+
+}
+
+// the exit status the way a shell reports it - killed by a signal is 128 + the signal number.
+int exitCodeOf(int status) {
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return 0;
+}
+
+int Command::getArgs(vector<string> &args) const {
+    if (parsed == nullptr)
+        return parseCommandLine(cmd_line, args);
+    for (unsigned int i = first_token; i < end_token; i++) {
+        if (parsed->tokens[i].type == TOKEN_WORD)
+            args.push_back(parsed->word(i));
+    }
+    return args.size();
+}
+
+// the input of a here document, as an fd to read it from. nothing is written to disk: a small body fits in a pipe,
+// a bigger one goes into a memfd which is sealed, so the command cannot change it.
+static int openHereBody(const string &body) {
+    if (body.size() <= HERE_PIPE_MAX) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            smashPerror("smash error: pipe failed");
+            return -1;
+        }
+        if (write(fds[1], body.data(), body.size()) != (ssize_t) body.size()) {
+            smashPerror("smash error: write failed");
+            close(fds[0]);
+            fds[0] = -1;
+        }
+        close(fds[1]);
+        return fds[0];
+    }
+    int fd = memfd_create("smash-here-document", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        smashPerror("smash error: memfd_create failed");
+        return -1;
+    }
+    size_t written = 0;
+    while (written < body.size()) {
+        ssize_t count = write(fd, body.data() + written, body.size() - written);
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count == -1) {
+            smashPerror("smash error: write failed");
+            close(fd);
+            return -1;
+        }
+        written += count;
+    }
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1 ||
+        lseek(fd, 0, SEEK_SET) == -1) {
+        smashPerror("smash error: failed to seal a here document");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool Command::redirectionActions(vector<FdAction> &actions, vector<int> &body_fds, bool leave_to_shell) const {
+    if (stage < 0)
+        return true;
+    const Stage &current = parsed->stages[stage];
+    size_t first_body_fd = body_fds.size();
+    for (unsigned int i = current.first_redirection; i < current.end_redirection; i++) {
+        const Redirection &redirection = parsed->redirections[i];
+        int fd = (redirection.fd == REDIRECT_BOTH) ? STDOUT_FILENO : redirection.fd;
+        if (redirection.type == REDIRECT_DUP) {
+            actions.push_back({fd, redirection.source_fd, nullptr, 0});
+            continue;
+        }
+        if (redirection.by_shell && leave_to_shell)
+            continue;
+        if (redirection.type == REDIRECT_HERE_DOC || redirection.type == REDIRECT_HERE_STRING) {
+            int body_fd = openHereBody(parsed->hereBody(redirection));
+            if (body_fd == -1) {
+                for (size_t j = first_body_fd; j < body_fds.size(); j++)
+                    close(body_fds[j]);
+                body_fds.resize(first_body_fd);
+                return false;
+            }
+            body_fds.push_back(body_fd);
+            actions.push_back({fd, body_fd, nullptr, 0});
+            continue;
+        }
+        int flags = O_RDONLY;
+        if (redirection.type != REDIRECT_IN)
+            flags = O_WRONLY | O_CREAT | (redirection.type == REDIRECT_APPEND ? O_APPEND : O_TRUNC);
+        actions.push_back({fd, -1, parsed->target(redirection), flags});
+        if (redirection.fd == REDIRECT_BOTH)
+            actions.push_back({STDERR_FILENO, STDOUT_FILENO, nullptr, 0});
+    }
+    return true;
+}
+
+bool Command::hasSubstitutions() const {
+    if (stage < 0)
+        return false;
+    for (const Substitution &substitution : parsed->substitutions) {
+        if (substitution.token >= first_token && substitution.token < end_token)
+            return true;
+    }
+    return false;
+}
+
+bool Command::startSubstitutions(vector<pair<int, int>> &fds, const vector<int> &close_fds) {
+    if (stage < 0)
+        return true;
+    SmallShell &smash = SmallShell::getInstance();
+    size_t first_fd = fds.size();
+    // a later substitution does not get the command's ends of the earlier ones either.
+    vector<int> inherited_fds(close_fds);
+    for (const Substitution &substitution : parsed->substitutions) {
+        if (substitution.token < first_token || substitution.token >= end_token)
+            continue;
+        int pipe_fds[2];
+        int pid = -1;
+        if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+            smashPerror("smash error: pipe failed");
+        } else {
+            int command_end = pipe_fds[substitution.to_command ? 1 : 0];
+            int inner_end = pipe_fds[substitution.to_command ? 0 : 1];
+            // dup2 onto the fd it is already on would leave it close-on-exec.
+            if (command_end >= SUBSTITUTION_FD - SUBSTITUTION_MAX && command_end <= SUBSTITUTION_FD) {
+                int moved = fcntl(command_end, F_DUPFD_CLOEXEC, SUBSTITUTION_FD + 1);
+                close(command_end);
+                command_end = moved;
+            }
+            inherited_fds.push_back(command_end);
+            if (command_end != -1) {
+                string command = parsed->line.substr(substitution.command_begin,
+                                                     substitution.command_end - substitution.command_begin);
+                pid = smash.launchSubstitution(command, inner_end,
+                                               substitution.to_command ? STDIN_FILENO : STDOUT_FILENO, inherited_fds);
+            }
+            close(inner_end);
+            if (pid >= 0) {
+                fds.push_back({command_end, substitution.fd});
+                substitution_pids.push_back(pid);
+            } else if (command_end != -1) {
+                close(command_end);
+            }
+        }
+        if (pid < 0) {
+            for (size_t i = first_fd; i < fds.size(); i++)
+                close(fds[i].first);
+            fds.resize(first_fd);
+            return false;
+        }
+    }
+    return true;
+}
+
+void Command::waitSubstitutions(bool stopped) {
+    if (substitution_pids.empty())
+        return;
+    EventLoop &event_loop = SmallShell::getInstance().event_loop;
+    if (stopped) {
+        event_loop.watchForeground(substitution_pids, false);
+    } else {
+        vector<int> statuses;
+        event_loop.waitForeground(substitution_pids, statuses);
+    }
+    substitution_pids.clear();
+}
+
+bool FdStreamBuf::writeOut(const char *data, size_t length) {
+    struct iovec parts[2] = {{pbase(), (size_t) (pptr() - pbase())}, {const_cast<char *>(data), length}};
+    int first = 0;
+    bool written_all = true;
+    while (first < 2) {
+        if (parts[first].iov_len == 0) {
+            first++;
+            continue;
+        }
+        ssize_t written = writev(fd, parts + first, 2 - first);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written == -1) {
+            written_all = false;
+            break;
+        }
+        // a short write leaves the rest of the iovecs for the next writev.
+        for (; first < 2 && (size_t) written >= parts[first].iov_len; first++)
+            written -= parts[first].iov_len;
+        if (first < 2) {
+            parts[first].iov_base = static_cast<char *>(parts[first].iov_base) + written;
+            parts[first].iov_len -= written;
+        }
+    }
+    setp(buffer.data(), buffer.data() + buffer.size());
+    return written_all;
+}
+
+int FdStreamBuf::overflow(int c) {
+    if (!writeOut(nullptr, 0))
+        return traits_type::eof();
+    if (c != traits_type::eof()) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+streamsize FdStreamBuf::xsputn(const char *data, streamsize length) {
+    if (length <= epptr() - pptr()) {
+        memcpy(pptr(), data, length);
+        pbump(length);
+    } else if (!writeOut(data, length)) {
+        return 0;
+    }
+    if (line_buffered && memchr(data, '\n', length) != nullptr && !writeOut(nullptr, 0))
+        return 0;
+    return length;
+}
+
+int FdStreamBuf::sync() {
+    return writeOut(nullptr, 0) ? 0 : -1;
+}
+
+void SmallShell::bufferOutput() {
+    cout.flush();
+    stdout_buf.open(STDOUT_FILENO, isatty(STDOUT_FILENO));
+    saved_cout_buf = cout.rdbuf(&stdout_buf);
+}
+
+SmallShell::~SmallShell() {
+    // cout outlives smash, so it gets its own buffer back before stdout_buf is gone.
+    if (saved_cout_buf != nullptr) {
+        cout.flush();
+        cout.rdbuf(saved_cout_buf);
+    }
+    for (ParsedLine *parsed : parsed_lines)
+        delete parsed;
+}
+
+bool BuiltinRedirection::apply(Command &cmd) {
+    SmallShell &smash = SmallShell::getInstance();
+    memcpy(saved_fds, smash.std_fds, sizeof(saved_fds));
+    vector<pair<int, int>> substitutions;
+    if (!cmd.startSubstitutions(substitutions))
+        return false;
+    smash.event_loop.watchForeground(cmd.substitution_pids, true);
+    for (auto &fds : substitutions) {
+        // whatever smash had on the fd is put back afterwards. -1 when it had nothing there.
+        int saved_fd = fcntl(fds.second, F_DUPFD_CLOEXEC, SUBSTITUTION_FD + 1);
+        substitution_fds.push_back({fds.second, saved_fd});
+        if (dup2(fds.first, fds.second) == -1)
+            smashPerror("smash error: dup2 failed");
+        close(fds.first);
+    }
+    int fds[3] = {saved_fds[0], saved_fds[1], saved_fds[2]};
+    vector<FdAction> actions;
+    if (!cmd.redirectionActions(actions, opened_fds))
+        return false;
+    size_t num_of_body_fds = opened_fds.size();
+    for (FdAction &action : actions) {
+        int fd;
+        if (action.path == nullptr) {
+            // the builtin reads a here document straight from its fd.
+            bool body_fd = find(opened_fds.begin(), opened_fds.begin() + num_of_body_fds, action.source_fd) !=
+                           opened_fds.begin() + num_of_body_fds;
+            if (action.source_fd > STDERR_FILENO && !body_fd) {
+                errno = EBADF;
+                smashPerror("smash error: dup2 failed");
+                return false;
+            }
+            fd = body_fd ? action.source_fd : fds[action.source_fd];
+        } else {
+            if ((fd = open(action.path, action.flags | O_CLOEXEC, REDIRECT_MODE)) == -1) {
+                smashPerror("smash error: open failed");
+                return false;
+            }
+            opened_fds.push_back(fd);
+        }
+        // a builtin only uses 0, 1 and 2. files redirected to other fds are only created.
+        if (action.fd <= STDERR_FILENO)
+            fds[action.fd] = fd;
+    }
+    if (fds[STDOUT_FILENO] != saved_fds[STDOUT_FILENO]) {
+        cout.flush();
+        out_buf.open(fds[STDOUT_FILENO]);
+        saved_out = cout.rdbuf(&out_buf);
+    }
+    if (fds[STDERR_FILENO] != saved_fds[STDERR_FILENO]) {
+        cerr.flush();
+        err_buf.open(fds[STDERR_FILENO]);
+        saved_err = cerr.rdbuf(&err_buf);
+    }
+    memcpy(smash.std_fds, fds, sizeof(fds));
+    return true;
+}
+
+BuiltinRedirection::~BuiltinRedirection() {
+    if (saved_out != nullptr) {
+        cout.flush();
+        cout.rdbuf(saved_out);
+    }
+    if (saved_err != nullptr) {
+        cerr.flush();
+        cerr.rdbuf(saved_err);
+    }
+    memcpy(SmallShell::getInstance().std_fds, saved_fds, sizeof(saved_fds));
+    for (int fd : opened_fds)
+        close(fd);
+    for (auto it = substitution_fds.rbegin(); it != substitution_fds.rend(); ++it) {
+        if (it->second == -1) {
+            close(it->first);
+        } else {
+            dup2(it->second, it->first);
+            close(it->second);
+        }
+    }
+}
+
+Command *SmallShell::CreateCommand(ParsedLine &parsed) {
+    string cmd_line = parsed.rawText(0, parsed.tokens.size());
+    Command *cmd;
+    // **************       SPECIAL COMMANDS       **************
+    // time applies to everything after it, pipes and redirections included.
+    if (parsed.tokens[0].type == TOKEN_WORD && strcmp(parsed.word(0), "time") == 0)
+        cmd = command_arena.create<TimeCommand>(cmd_line);
+    else if (parsed.stages.size() > 1)
+        cmd = command_arena.create<PipeCommand>(cmd_line);
+    else
+        return CreateSimpleCommand(parsed, parsed.stages[0].first_token, parsed.stages[0].end_token, 0);
+    cmd->parsed = &parsed;
+    cmd->first_token = 0;
+    cmd->end_token = parsed.tokens.size();
+    return cmd;
+}
+
+Command *SmallShell::CreateSimpleCommand(ParsedLine &parsed, unsigned int first_token, unsigned int end_token,
+                                         int stage) {
+    string cmd_line = parsed.rawText(first_token, end_token);
+    const char *firstWord = parsed.word(parsed.nextWord(first_token, end_token));
+    Command *cmd = nullptr;
+    // **************       BUILT IN COMMANDS       **************
+    switch (commandHash(firstWord)) {
+#define BUILTIN_CASE(name, type, ctor_args)                        \
+        case commandHash(name):                                    \
+            if (strcmp(firstWord, name) == 0)                      \
+                cmd = command_arena.create<type> ctor_args;        \
+            break;
+        SMASH_BUILTINS(BUILTIN_CASE)
+#undef BUILTIN_CASE
+        default:
+            break;
+    }
+    // **************       EXTERNAL COMMANDS       **************
+    // cat and the text filters are programs too, which bash runs when the line needs it (a glob, a here document
+    // with expansions...).
+    if ((dynamic_cast<TextFilterCommand *>(cmd) != nullptr || dynamic_cast<CatCommand *>(cmd) != nullptr) &&
+        parsed.needsShell(first_token, end_token))
+        cmd = nullptr;
+    if (cmd == nullptr)
+        cmd = command_arena.create<ExternalCommand>(cmd_line);
+    cmd->parsed = &parsed;
+    cmd->first_token = first_token;
+    cmd->end_token = end_token;
+    cmd->stage = stage;
+    cmd->is_bg = parsed.background;
+    return cmd;
+}
+
+void SmallShell::logUsage(const string &command, int pid, int status, const struct rusage &usage) {
+    if (time_log != nullptr)
+        time_log->push_back(ProcessUsage {command, pid, status, usage});
+}
+
+void smashPerror(const char *message) {
+    perror(message);
+    SmallShell::getInstance().errors_printed++;
+}
+
+void smashError(const char *message) {
+    fprintf(stderr, "%s\n", message);
+    SmallShell::getInstance().errors_printed++;
+}
+
+void SmallShell::executeCommand(const char *cmd_line, size_t length) {
+    // finished jobs were already reaped by the event loop when they changed state.
+    // a command may run another line while its own is still in use, so every nesting level has its own parsed line.
+    if (parse_depth == parsed_lines.size())
+        parsed_lines.push_back(new ParsedLine());
+    ParsedLine &parsed = *parsed_lines[parse_depth];
+    if (!parsed.parse(cmd_line, length)) {
+        // an empty line is not an error.
+        if (!parsed.tokens.empty()) {
+            smashPerror("smash error: syntax error");
+            last_status = 1;
+        }
+        return;
+    }
+    parse_depth++;
+    CommandArena::Mark mark = command_arena.mark();
+    Command *cmd = CreateCommand(parsed);
+    cmd->un_proccessed_cmd = parsed.line;
+    // external commands get the status of their process. builtins succeed unless they set one or print an error.
+    unsigned long errors_before = errors_printed;
+    bool builtin = (dynamic_cast<ExternalCommand *>(cmd) == nullptr);
+    if (builtin)
+        last_status = 0;
+    // external commands apply their redirections in the child, builtins write to the opened files themselves.
+    if ((cmd->hasRedirections() || cmd->hasSubstitutions()) && dynamic_cast<ExternalCommand *>(cmd) == nullptr) {
+        {
+            BuiltinRedirection redirection;
+            if (redirection.apply(*cmd))
+                cmd->execute();
+            else
+                last_status = 1;
+        }
+        // with smash's ends of their pipes closed, so a >(cmd) sees the end of its input.
+        cmd->waitSubstitutions(false);
+    } else {
+        cmd->execute();
+    }
+    if (errors_printed != errors_before && last_status == 0)
+        last_status = 1;
+    command_arena.release(mark);
+    parse_depth--;
+}
+
+bool SmallShell::expandHistory(string &line) {
+    size_t first = line.find_first_not_of(WHITESPACE);
+    // a lone !, or != as in a test, is left as it is.
+    if (first == string::npos || line[first] != '!' || first + 1 == line.size() ||
+        WHITESPACE.find(line[first + 1]) != string::npos || line[first + 1] == '=')
+        return true;
+    size_t word_end = line.find_first_of(WHITESPACE, first);
+    if (word_end == string::npos)
+        word_end = line.size();
+    string word = line.substr(first + 1, word_end - first - 1);
+    history.sync();
+    unsigned int number = 0;
+    bool negative = (word[0] == '-');
+    string digits = negative ? word.substr(1) : word;
+    if (word == "!") {
+        number = history.size();
+    } else if (!digits.empty() && digits.size() < 10 && digits.find_first_not_of("0123456789") == string::npos) {
+        unsigned int n = stoul(digits);
+        number = !negative ? n : (n <= history.size() ? history.size() + 1 - n : 0);
+    } else {
+        number = history.findPrefix(word.data(), word.size());
+    }
+    HistoryEntry entry {};
+    if (!history.entry(number, entry)) {
+        string error_str = "smash error: !" + word + ": event not found";
+        smashPerror(error_str.c_str());
+        return false;
+    }
+    line = string(entry.command, entry.record->command_length) + line.substr(word_end);
+    // the line which really runs is shown, like bash does.
+    cout << line << '\n';
+    return true;
+}
+
+int SmallShell::launchSubstitution(const string &command, int fd, int target, const vector<int> &close_fds) {
+    ParsedLine inner;
+    if (inner.parse(command) && inner.stages.size() == 1 && !inner.background) {
+        CommandArena::Mark mark = command_arena.mark();
+        Command *cmd = CreateSimpleCommand(inner, inner.stages[0].first_token, inner.stages[0].end_token, 0);
+        ExternalCommand *external_cmd = dynamic_cast<ExternalCommand *>(cmd);
+        int pid = -1;
+        if (external_cmd != nullptr) {
+            LaunchSpec spec;
+            if (external_cmd->prepareLaunch(spec)) {
+                spec.dup_fds.push_back({fd, target});
+                pid = launcher.launch(spec);
+            }
+        }
+        command_arena.release(mark);
+        if (external_cmd != nullptr)
+            return pid;
+    }
+
+    // the forked smash would print whatever is still buffered a second time.
+    cout.flush();
+    int pid = fork();
+    if (pid < 0) {
+        smashPerror("smash error: fork failed");
+        return -1;
+    }
+    if (pid == 0) {
+        event_loop.reinitAfterFork();
+        setpgid(0, 0);
+        for (int close_fd : close_fds)
+            close(close_fd);
+        if (dup2(fd, target) == -1) {
+            smashPerror("smash error: dup2 failed");
+            _exit(1);
+        }
+        close(fd);
+        std_fds[target] = target;
+        executeCommand(command);
+        cout.flush();
+        _exit(last_status);
+    }
+    return pid;
+}
+
+void SmallShell::readHereBodies(string &line) {
+    ParsedLine parsed;
+    if (!parsed.parse(line))
+        return;
+    for (const Redirection &redirection : parsed.redirections) {
+        if (redirection.type != REDIRECT_HERE_DOC)
+            continue;
+        string delimiter = parsed.hereDelimiter(redirection);
+        while (true) {
+            if (event_loop.interactive)
+                cout << "> " << flush;
+            LineView body_line;
+            // like bash, the end of the input ends the here document too.
+            if (!event_loop.readLine(body_line))
+                return;
+            line.push_back('\n');
+            line.append(body_line.data, body_line.length);
+            size_t text_begin = 0;
+            while (redirection.strip_tabs && text_begin < body_line.length && body_line.data[text_begin] == '\t')
+                text_begin++;
+            if (delimiter.compare(0, string::npos, body_line.data + text_begin, body_line.length - text_begin) == 0)
+                break;
+        }
+    }
+}
+
+void SmallShell::executeInputLine(const char *cmd_line, size_t length) {
+    bool here_doc = (memmem(cmd_line, length, "<<", 2) != nullptr);
+    if (!history.recording && !here_doc) {
+        executeCommand(cmd_line, length);
+        return;
+    }
+    string line(cmd_line, length);
+    if (history.recording && !expandHistory(line))
+        return;
+    // the line is copied first, reading the bodies replaces what cmd_line points to.
+    if (line.find("<<") != string::npos)
+        readHereBodies(line);
+    if (!history.recording) {
+        executeCommand(line);
+        return;
+    }
+    string command = both_trim(line);
+    if (command.empty())
+        return;
+    char cwd[PATH_MAX_CD];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr)
+        cwd[0] = '\0';
+    time_t start_time = time(nullptr);
+    long long start = TimeOutList::now();
+    executeCommand(line);
+    history.append(command, cwd, last_status, start_time, TimeOutList::now() - start);
+}
+
+// ***********************************************************************************************************************************
+// **********************************                BUILT IN EXECUTE                 ************************************************
+// ***********************************************************************************************************************************
+
+void ChangePromptCommand::execute() {
+    vector<string> args;
+    if (getArgs(args) == 1)
+        SmallShell::getInstance().prompt = "smash> ";
+    else {
+        SmallShell::getInstance().prompt = args[1] + "> ";
+    }
+}
+
+void ShowPidCommand::execute() {
+    int ret_pid = 0;
+    SYS_CALL(ret_pid, getpid());
+    cout << "smash pid is " << ret_pid << '\n';
+}
+
+void GetCurrDirCommand::execute() {
+    char current_pwd[PATH_MAX_CD];
+    if (getcwd(current_pwd, PATH_MAX_CD) != nullptr)
+        cout << current_pwd << '\n';
+    else
+        smashPerror("smash error: pwd failed");
+}
+
+void ChangeDirCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    vector<string> args;
+    int return_val;
+    int num_of_args = getArgs(args);
+
+    // too many args.
+    if (num_of_args >= 3) {
+        smashPerror("smash error: cd: too many arguments");
+        return;
+    }
+    // no args - do nothing.
+    if (num_of_args == 1)
+        return;
+    // change to specific dir.
+    if (args[1] != "-") {
+        char current_pwd[PATH_MAX_CD];
+        getcwd(current_pwd, PATH_MAX_CD);
+        SYS_CALL(return_val, chdir(args[1].c_str()));
+        smash.prev_wd = string(current_pwd);
+        // change to prev dir.
+    } else {
+        if (smash.prev_wd.empty()) {
+            smashPerror("smash error: cd: OLDPWD not set");
+            return;
+        } else {
+            char current_pwd[PATH_MAX_CD];
+            getcwd(current_pwd, PATH_MAX_CD);
+            SYS_CALL(return_val, chdir(smash.prev_wd.c_str()));
+            smash.prev_wd = string(current_pwd);
+        }
+    }
+}
+
+void JobsCommand::execute() {
+    // jobs which died on a limit are reported once.
+    for (auto &limit_kill : jobs_list->limit_kills)
+        cout << limit_kill << '\n';
+    jobs_list->limit_kills.clear();
+    // the list is ordered by job id already.
+    for (auto &it : jobs_list->job_list) {
+        JobEntry &job = it.second;
+        if (job.is_finished)
+            continue;
+        cout << "[" << job.job_id << "]" << job.job_command << " : " << job.process_id << " "
+             << job.calc_job_elapsed_time() << " secs" << (job.is_stopped ? " (stopped)" : "");
+        // jobs launched with run show where they run and what they are capped at.
+        string placement = job.placement.describe(), limits = job.limits.describe();
+        if (!placement.empty() || !limits.empty())
+            cout << " [" << placement << (placement.empty() || limits.empty() ? "" : " ") << limits << "]";
+        cout << '\n';
+    }
+}
+
+void KillCommand::execute() {
+    vector<string> args;
+    int num_of_args = getArgs(args);
+
+    if (num_of_args != 3 || args[1][0] != '-') {
+        smashPerror("smash error: kill: invalid arguments");
+        return;
+    }
+
+    // removes - sign from the first number.
+    args[1].erase(0, 1);
+    bool check_if_second_is_int = (args[1].find_first_not_of("-0123456789") == std::string::npos);
+    bool check_if_third_is_int = (args[2].find_first_not_of("-0123456789") == std::string::npos);
+
+    // second and third argument must be numbers.
+    if (!check_if_second_is_int || !check_if_third_is_int) {
+        smashPerror("smash error: kill: invalid arguments");
+        return;
+    }
+
+    SmallShell &smash = SmallShell::getInstance();
+    int signum = stoi(args[1]);
+    int job_id = stoi(args[2]);
+    JobEntry *job_to_handle;
+
+    if ((job_to_handle = smash.jobs.getJobById(job_id)) == nullptr) {
+        string job_id_error = "smash error: kill: job-id " + args[2] + " does not exist";
+        smashPerror(job_id_error.c_str());
+    } else {
+        // done with error handling. Now execute kill.
+        if (job_to_handle->sendSignal(signum) == -1) {
+            smashPerror("smash error: kill failed");
+            return;
+        }
+        // the event loop marks the job stopped or running when the signal takes effect.
+        cout << "signal number " << args[1] << " was sent to pid " << job_to_handle->process_id << '\n';
+    }
+}
+
+void ForegroundCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    JobEntry *job_to_handle = nullptr;
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    int status;
+    // too many arguments.
+    if (num_of_args > 2) {
+        smashPerror("smash error: fg: invalid arguments");
+        return;
+    } else if (num_of_args == 1) {
+        // no arguments but job list is emtpy.
+        if (smash.jobs.job_list.empty()) {
+            smashPerror("smash error: fg: jobs list is empty");
+            return;
+        }
+            // no arguments so get the maximum job.
+        else {
+            job_to_handle = smash.jobs.getMaxJob();
+            if (job_to_handle->is_stopped)
+                job_to_handle->continue_job();
+        }
+    }
+        // specific job handling.
+    else {
+        bool check_if_id_is_num = args[1].find_first_not_of("-0123456789") == std::string::npos;
+        if(!check_if_id_is_num) {
+            smashPerror("smash error: fg: invalid arguments");
+            return;
+        }
+
+        int job_id = stoi(args[1]);
+        job_to_handle = smash.jobs.getJobById(job_id);
+        // specific job does not exists in the list.
+        if (job_to_handle == nullptr) {
+            string error_str = "smash error: fg: job-id " + args[1] + " does not exist";
+            smashPerror(error_str.c_str());
+            return;
+        } else {
+            if (job_to_handle->is_stopped)
+                job_to_handle->continue_job();
+        }
+    }
+    smash.current_fg_pid = job_to_handle->process_id;
+    smash.current_fg_job_id = job_to_handle->job_id;
+    smash.curr_fg_command = this;
+    cout << job_to_handle->job_command + " : " + to_string(job_to_handle->process_id) << '\n';
+    // wait until job_to_handled is finished or someone has stopped it.
+    struct rusage usage {};
+    status = smash.event_loop.waitForeground(job_to_handle->process_id, &usage);
+    if (WIFSTOPPED(status) && smash.jobs.getJobById(job_to_handle->job_id) != nullptr)
+        smash.jobs.setStopped(job_to_handle, true);
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        smash.last_status = exitCodeOf(status);
+        smash.logUsage(job_to_handle->job_command, job_to_handle->process_id, status, usage);
+        smash.jobs.removeJobById(job_to_handle->job_id);
+        smash.current_fg_pid = -1;
+        smash.current_fg_job_id = -1;
+    }
+    smash.jobs.update_max_id();
+}
+
+void BackgroundCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    JobEntry *job_to_handle;
+    // invalid arguments.
+    if (num_of_args > 2) {
+        smashPerror("smash error: bg: invalid arguments");
+        return;
+    }
+
+    if (num_of_args == 1) {
+        job_to_handle = smash.jobs.getLastStoppedJob();
+        // jobs list is empty.
+        if (job_to_handle == nullptr) {
+            smashPerror("smash error: bg: there is no stopped jobs to resume");
+            return;
+        }
         // handle specific job.
     } else {
         bool check_if_id_is_num = args[1].find_first_not_of("-0123456789") == std::string::npos;
         if(!check_if_id_is_num) {
-            perror("smash error: bg: invalid arguments");
+            smashPerror("smash error: bg: invalid arguments");
             return;
         }
         int job_id = stoi(args[1]);
         job_to_handle = smash.jobs.getJobById(job_id);
         if (job_to_handle == nullptr) {
             string error_str = "smash error: bg: job-id " + args[1] + " does not exist";
-            perror(error_str.c_str());
+            smashPerror(error_str.c_str());
+            return;
+        }
+        if (!job_to_handle->is_stopped) {
+            string error_str = "smash error: bg: job-id " + args[1] + " is already running in the background";
+            smashPerror(error_str.c_str());
+            return;
+        }
+    }
+    job_to_handle->continue_job();
+}
+
+void QuitCommand::execute() {
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    // with kill argument.
+    if (num_of_args >= 2 && args[1] == "kill") {
+        cout << "smash: sending SIGKILL signal to " << jobs_list->job_list.size() << " jobs:" << '\n';
+        for (auto &it : jobs_list->job_list) {
+            JobEntry &job = it.second;
+            if (job.sendSignal(SIGKILL) == -1)
+                smashPerror("smash error: kill failed");
+            else
+                cout << job.process_id << ": " << job.job_command << '\n';
+        }
+    }
+    exit(0);
+}
+
+void LauncherCommand::execute() {
+    Launcher &launcher = SmallShell::getInstance().launcher;
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    if (num_of_args == 1) {
+        cout << "smash: launcher is " << Launcher::backendName(launcher.backend) << '\n';
+        return;
+    }
+    if (num_of_args > 2 || (args[1] != "fork" && args[1] != "spawn")) {
+        smashPerror("smash error: launcher: invalid arguments");
+        return;
+    }
+    launcher.backend = (args[1] == "fork") ? LAUNCH_FORK : LAUNCH_SPAWN;
+}
+
+void CaptureCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    if (num_of_args == 1) {
+        if (smash.capture_size == 0)
+            cout << "smash: capture is off" << '\n';
+        else
+            cout << "smash: capture is on, " << smash.capture_size << " bytes per job" << '\n';
+        return;
+    }
+    rlim_t size = CAPTURE_RING_SIZE;
+    bool valid = (args[1] == "off" && num_of_args == 2) ||
+                 (args[1] == "on" && (num_of_args == 2 || (num_of_args == 3 && parseSize(args[2], size))));
+    if (!valid) {
+        smashPerror("smash error: capture: invalid arguments");
+        return;
+    }
+    // jobs which are already running keep what they had.
+    smash.capture_size = (args[1] == "on") ? size : 0;
+}
+
+void JobLogCommand::execute() {
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    unsigned int lines = 0;
+    bool valid = (num_of_args == 2 || (num_of_args == 4 && args[2] == "--tail")) && args[1].size() < 10 &&
+                 args[1].find_first_not_of("0123456789") == string::npos && !args[1].empty();
+    if (valid && num_of_args == 4) {
+        valid = !args[3].empty() && args[3].size() < 10 && args[3].find_first_not_of("0123456789") == string::npos;
+        if (valid)
+            lines = stoul(args[3]);
+    }
+    if (!valid) {
+        smashPerror("smash error: joblog: invalid arguments");
+        return;
+    }
+    int job_id = stoi(args[1]);
+    OutputRing *output = jobs_list->getOutput(job_id);
+    if (output == nullptr) {
+        string error_str = "smash error: joblog: job-id " + args[1] + " has no captured output";
+        smashPerror(error_str.c_str());
+        return;
+    }
+    // whatever the job wrote since the event loop last ran.
+    output->drain();
+    if (output->total > output->size)
+        cerr << "smash: joblog: [" << job_id << "] " << output->total - output->size << " earlier bytes were dropped"
+             << endl;
+    cout << output->tail(lines) << flush;
+}
+
+void HistoryCommand::printEntry(const HistoryEntry &entry, bool verbose) {
+    cout << setw(5) << entry.number << "  ";
+    if (verbose) {
+        char when[32], duration[32];
+        time_t start_time = entry.record->start_time;
+        struct tm local {};
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&start_time, &local));
+        snprintf(duration, sizeof(duration), "%.3fs", entry.record->duration_ns / 1e9);
+        cout << when << "  " << duration << "  exit " << entry.record->status << "  "
+             << string(entry.cwd, entry.record->cwd_length) << "  ";
+    }
+    cout.write(entry.command, entry.record->command_length);
+    cout << '\n';
+}
+
+void HistoryCommand::execute() {
+    History &history = SmallShell::getInstance().history;
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    bool verbose = (num_of_args > 1 && args[1] == "-v");
+    int first_arg = verbose ? 2 : 1;
+    int rest = num_of_args - first_arg;
+    bool valid = (rest == 0) || (rest == 1 && args[first_arg].size() < 10 &&
+                                 args[first_arg].find_first_not_of("0123456789") == string::npos) ||
+                 (rest == 2 && (args[first_arg] == "-p" || args[first_arg] == "-s"));
+    if (!valid) {
+        smashPerror("smash error: history: invalid arguments");
+        return;
+    }
+    // only the sessions which record keep the file open, the others read it when asked.
+    if (!history.isOpen() && !history.open(History::defaultPath()))
+        return;
+    history.sync();
+    HistoryEntry entry {};
+    if (rest == 2) {
+        vector<unsigned int> numbers = (args[first_arg] == "-p") ? history.searchPrefix(args[first_arg + 1])
+                                                                 : history.searchText(args[first_arg + 1]);
+        for (unsigned int number : numbers) {
+            if (history.entry(number, entry))
+                printEntry(entry, verbose);
+        }
+    } else {
+        size_t count = (rest == 1) ? min((size_t) stoul(args[first_arg]), history.size()) : history.size();
+        for (unsigned int number = history.size() - count + 1; number <= history.size(); number++) {
+            if (history.entry(number, entry))
+                printEntry(entry, verbose);
+        }
+    }
+    cout << flush;
+}
+
+void PipeFailCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    if (num_of_args == 1) {
+        cout << "smash: pipefail is " << (smash.pipefail ? "on" : "off") << '\n';
+        return;
+    }
+    if (num_of_args > 2 || (args[1] != "on" && args[1] != "off")) {
+        smashPerror("smash error: pipefail: invalid arguments");
+        return;
+    }
+    smash.pipefail = (args[1] == "on");
+}
+
+void PipeStatusCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    if (smash.pipe_statuses.empty())
+        return;
+    for (unsigned int i = 0; i < smash.pipe_statuses.size(); i++)
+        cout << (i == 0 ? "" : " ") << smash.pipe_statuses[i];
+    cout << '\n';
+}
+
+void HashCommand::execute() {
+    PathCache &path_cache = SmallShell::getInstance().path_cache;
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    // no arguments - print the table.
+    if (num_of_args == 1) {
+        if (path_cache.entries.empty()) {
+            cout << "smash: hash table empty" << '\n';
             return;
         }
-        if (!job_to_handle->is_stopped) {
-            string error_str = "smash error: bg: job-id " + args[1] + " is already running in the background";
-            perror(error_str.c_str());
+        cout << "hits\tcommand" << '\n';
+        for (auto &it : path_cache.entries)
+            cout << setw(4) << it.second.hits << "\t" << it.second.path << '\n';
+        return;
+    }
+    if (args[1] == "-r") {
+        path_cache.flush();
+        return;
+    }
+    if (args[1] == "-d") {
+        for (int i = 2; i < num_of_args; i++) {
+            if (path_cache.entries.find(args[i]) == path_cache.entries.end()) {
+                string error_str = "smash error: hash: " + args[i] + ": not found";
+                smashPerror(error_str.c_str());
+            } else
+                path_cache.remove(args[i]);
+        }
+        return;
+    }
+    for (int i = 1; i < num_of_args; i++) {
+        if (!path_cache.insert(args[i])) {
+            string error_str = "smash error: hash: " + args[i] + ": not found";
+            smashPerror(error_str.c_str());
+        }
+    }
+}
+
+// ***********************************************************************************************************************************
+// **********************************                EXTERNAL EXECUTE                 ************************************************
+// ***********************************************************************************************************************************
+
+bool ExternalCommand::prepareLaunch(LaunchSpec &spec) {
+    SmallShell &smash = SmallShell::getInstance();
+    // simple commands are executed directly with the words of the parsed line, everything else goes through bash.
+    if (parsed != nullptr && !parsed->needsShell(first_token, end_token)) {
+        for (unsigned int i = first_token; i < end_token; i++) {
+            if (parsed->tokens[i].type == TOKEN_WORD)
+                spec.argv.push_back(parsed->word(i));
+        }
+        // a command which is not on PATH is still launched, so exec reports the error like any other failure.
+        if (!smash.path_cache.resolve(spec.argv[0], spec.path))
+            spec.path = spec.argv[0];
+    } else {
+        spec.path = "/bin/bash";
+        spec.args = {"/bin/bash", "-c", cmd_line};
+    }
+    // a builtin running with redirections passes them on to what it launches. copies of 0, 1 and 2 go first, before
+    // those are replaced.
+    for (bool from_std : {true, false}) {
+        for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) {
+            if (smash.std_fds[fd] != fd && (smash.std_fds[fd] <= STDERR_FILENO) == from_std)
+                spec.dup_fds.push_back({smash.std_fds[fd], fd});
+        }
+    }
+    spec.placement = placement;
+    spec.limits = limits;
+    if (!redirectionActions(spec.fd_actions, spec.owned_fds, spec.argv.empty()))
+        return false;
+    // bash starts the substitutions of a command it runs itself. the command gets the pipes before its redirections
+    // are applied, so < <(cmd) opens one of them.
+    size_t first_dup = spec.dup_fds.size();
+    vector<int> inherited_fds(spec.close_fds);
+    inherited_fds.insert(inherited_fds.end(), spec.owned_fds.begin(), spec.owned_fds.end());
+    if (!spec.argv.empty() && !startSubstitutions(spec.dup_fds, inherited_fds)) {
+        for (int fd : spec.owned_fds)
+            close(fd);
+        spec.owned_fds.clear();
+        return false;
+    }
+    for (size_t i = first_dup; i < spec.dup_fds.size(); i++)
+        spec.owned_fds.push_back(spec.dup_fds[i].first);
+    return true;
+}
+
+void ExternalCommand::execute() {
+
+    bool is_background = is_bg;
+    SmallShell &smash = SmallShell::getInstance();
+
+    LaunchSpec spec;
+    if (!prepareLaunch(spec)) {
+        smash.last_status = 1;
+        return;
+    }
+    // with capture on, a background job writes into a pipe smash drains, not to the terminal.
+    int capture_fds[2] = {-1, -1};
+    if (is_background && smash.capture_size > 0) {
+        if (pipe2(capture_fds, O_CLOEXEC) == -1 || fcntl(capture_fds[0], F_SETFL, O_NONBLOCK) == -1) {
+            smashPerror("smash error: pipe failed");
+            if (capture_fds[0] != -1) {
+                close(capture_fds[0]);
+                close(capture_fds[1]);
+            }
+            capture_fds[0] = -1;
+        } else {
+            spec.dup_fds.push_back({capture_fds[1], STDOUT_FILENO});
+            spec.dup_fds.push_back({capture_fds[1], STDERR_FILENO});
+        }
+    }
+    int pid = smash.launcher.launch(spec);
+    if (capture_fds[0] != -1)
+        close(capture_fds[1]);
+    if (pid < 0) {
+        if (capture_fds[0] != -1)
+            close(capture_fds[0]);
+        return;
+    }
+
+    if (this->is_time_out)
+        smash.time_out_list.add_entry(cmd_line, un_proccessed_cmd, pid, kill_time, is_background);
+
+    if (is_background) {
+        smash.jobs.addJob(this, pid, false);
+        if (capture_fds[0] != -1) {
+            smash.jobs.getJobByPId(pid)->output = new OutputRing(smash.capture_size, capture_fds[0]);
+            smash.event_loop.watchOutput(capture_fds[0], pid);
+        }
+    } else {
+        smash.current_fg_pid = pid;
+        smash.curr_fg_command = this;
+        struct rusage usage {};
+        smash.event_loop.watchForeground(substitution_pids, true);
+        int status = smash.event_loop.waitForeground(pid, &usage);
+        waitSubstitutions(WIFSTOPPED(status));
+        smash.last_status = exitCodeOf(status);
+        if (!WIFSTOPPED(status))
+            smash.logUsage(cmd_line, pid, status, usage);
+        // it finished before its deadline.
+        if (this->is_time_out && !WIFSTOPPED(status))
+            smash.time_out_list.remove_entry(pid);
+        // stopped by a signal from outside smash (ctrl-Z adds the job itself).
+        if (WIFSTOPPED(status) && smash.jobs.getJobByPId(pid) == nullptr)
+            smash.jobs.addJob(this, pid, true);
+        smash.current_fg_pid = -1;
+        smash.curr_fg_command = nullptr;
+    }
+}
+
+// ***********************************************************************************************************************************
+// **********************************                SPECIAL EXECUTE                 *************************************************
+// ***********************************************************************************************************************************
+
+const char *CatCommand::methodName(CopyMethod method) {
+    switch (method) {
+        case COPY_FILE_RANGE:
+            return "copy_file_range";
+        case COPY_SPLICE:
+            return "splice";
+        case COPY_SENDFILE:
+            return "sendfile";
+        default:
+            return "read/write";
+    }
+}
+
+// unsupported is set when the kernel refused the method before copying anything, so the caller can try another one.
+ssize_t CatCommand::copyZero(int in_fd, int out_fd, CopyMethod method, bool &unsupported) {
+    ssize_t total = 0, copied;
+    unsupported = false;
+    while (true) {
+        if (method == COPY_FILE_RANGE)
+            copied = copy_file_range(in_fd, nullptr, out_fd, nullptr, COPY_CHUNK_SIZE, 0);
+        else if (method == COPY_SPLICE)
+            copied = splice(in_fd, nullptr, out_fd, nullptr, COPY_CHUNK_SIZE, SPLICE_F_MOVE);
+        else
+            copied = sendfile(out_fd, in_fd, nullptr, COPY_CHUNK_SIZE);
+        if (copied == 0)
+            return total;
+        if (copied == -1) {
+            if (errno == EINTR)
+                continue;
+            if (total == 0 && (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EBADF ||
+                               errno == EOPNOTSUPP || errno == ETXTBSY)) {
+                unsupported = true;
+                return 0;
+            }
+            smashPerror((string("smash error: ") + methodName(method) + " failed").c_str());
+            return -1;
+        }
+        total += copied;
+    }
+}
+
+ssize_t CatCommand::copyBuffered(int in_fd, int out_fd, size_t buffer_size) {
+    vector<char> buff(buffer_size);
+    ssize_t total = 0, input_read;
+    while (true) {
+        if ((input_read = read(in_fd, buff.data(), buffer_size)) == -1) {
+            if (errno == EINTR)
+                continue;
+            smashPerror("smash error: read failed");
+            return -1;
+        }
+        // when we finish the file, input read will be 0.
+        if (input_read == 0)
+            return total;
+        ssize_t written = 0;
+        while (written < input_read) {
+            ssize_t res = write(out_fd, buff.data() + written, input_read - written);
+            if (res == -1) {
+                if (errno == EINTR)
+                    continue;
+                smashPerror("smash error: write failed");
+                return -1;
+            }
+            written += res;
+        }
+        total += input_read;
+    }
+}
+
+ssize_t CatCommand::copyFd(int in_fd, int out_fd, size_t buffer_size, CopyMethod &method) {
+    struct stat in_stat {}, out_stat {};
+    if (fstat(in_fd, &in_stat) == -1 || fstat(out_fd, &out_stat) == -1) {
+        method = COPY_BUFFERED;
+        return copyBuffered(in_fd, out_fd, buffer_size);
+    }
+    // pick the kernel path by what the output is: a file (redirection), a pipe, or anything else.
+    vector<CopyMethod> candidates;
+    if (S_ISREG(in_stat.st_mode) && S_ISREG(out_stat.st_mode))
+        candidates.push_back(COPY_FILE_RANGE);
+    if (S_ISFIFO(out_stat.st_mode) || S_ISFIFO(in_stat.st_mode))
+        candidates.push_back(COPY_SPLICE);
+    if (S_ISREG(in_stat.st_mode))
+        candidates.push_back(COPY_SENDFILE);
+
+    for (CopyMethod candidate : candidates) {
+        bool unsupported;
+        ssize_t copied = copyZero(in_fd, out_fd, candidate, unsupported);
+        if (!unsupported) {
+            method = candidate;
+            return copied;
+        }
+    }
+    method = COPY_BUFFERED;
+    return copyBuffered(in_fd, out_fd, buffer_size);
+}
+
+void CatCommand::execute() {
+    vector<string> args;
+    int num_of_args = getArgs(args);
+
+    // options: -v reports bytes and time per file, -B <bytes> sets the buffer size of the fallback loop.
+    bool verbose = false;
+    size_t buffer_size = BUFFER_SIZE;
+    int first_file = 1;
+    while (first_file < num_of_args && (args[first_file] == "-v" || args[first_file] == "-B")) {
+        if (args[first_file] == "-v") {
+            verbose = true;
+            first_file++;
+            continue;
+        }
+        bool is_size = first_file + 1 < num_of_args && !args[first_file + 1].empty() &&
+                       args[first_file + 1].size() < 10 &&
+                       args[first_file + 1].find_first_not_of("0123456789") == std::string::npos &&
+                       stol(args[first_file + 1]) > 0;
+        if (!is_size) {
+            smashPerror("smash error: cat: invalid arguments");
             return;
         }
+        buffer_size = stol(args[first_file + 1]);
+        first_file += 2;
+    }
+    // without files it copies stdin, which is how a here document or a pipe reaches it.
+    SmallShell &smash = SmallShell::getInstance();
+    if (first_file == num_of_args)
+        args.push_back("-");
+    for (size_t i = first_file; i < args.size(); i++) {
+        bool is_stdin = (args[i] == "-");
+        int fd = is_stdin ? smash.std_fds[STDIN_FILENO] : open(args[i].c_str(), O_RDONLY);
+        if (fd == -1) {
+            smashPerror("smash error: open failed");
+            continue;
+        }
+        struct timespec start {}, end {};
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        CopyMethod method;
+        ssize_t copied = copyFd(fd, smash.std_fds[STDOUT_FILENO], buffer_size, method);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (!is_stdin && close(fd) == -1)
+            smashPerror("smash error: close failed");
+        if (verbose && copied >= 0) {
+            double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            cerr << "smash: cat: " << args[i] << ": " << copied << " bytes in " << fixed << setprecision(6)
+                 << elapsed << " secs (" << methodName(method) << ")" << endl;
+        }
     }
-    job_to_handle->continue_job();
 }
 
-void QuitCommand::execute() {
-    vector<string> args;
-    int num_of_args = parseCommandLine(cmd_line, args);
-    // with kill argument.
-    if (num_of_args >= 2 && args[1] == "kill") {
-        cout << "smash: sending SIGKILL signal to " << jobs_list->job_list.size() << " jobs:" << endl;
-        for (auto &it : jobs_list->job_list) {
-            if (kill(it.process_id, SIGKILL) == -1)
-                perror("smash error: kill failed");
-            else
-                cout << it.process_id << ": " << it.job_command << endl;
+// the files of a filter, from first on. without any it reads stdin, which is named "-" like in the other tools.
+static vector<string> filterInputs(const vector<string> &args, int first) {
+    vector<string> inputs(args.begin() + first, args.end());
+    if (inputs.empty())
+        inputs.push_back("-");
+    return inputs;
+}
+
+// -1 when it cannot be opened. stdin is not closed after reading.
+static int openFilterInput(const string &name) {
+    if (name == "-")
+        return SmallShell::getInstance().std_fds[STDIN_FILENO];
+    int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        smashPerror("smash error: open failed");
+    return fd;
+}
+
+static void closeFilterInput(const string &name, int fd) {
+    if (name != "-" && close(fd) == -1)
+        smashPerror("smash error: close failed");
+}
+
+// -n N or -N, for head and tail. returns false when args[i] is neither, or the number is not valid (then valid is
+// false).
+static bool lineCountOption(const vector<string> &args, int &i, long &lines, bool &valid) {
+    string number;
+    int used = 1;
+    if (args[i] == "-n" && i + 1 < (int) args.size()) {
+        number = args[i + 1];
+        used = 2;
+    } else if (args[i].size() > 1 && args[i][0] == '-' && isdigit(args[i][1])) {
+        number = args[i].substr(1);
+    } else {
+        return false;
+    }
+    valid = !number.empty() && number.size() < 10 && number.find_first_not_of("0123456789") == string::npos;
+    if (valid)
+        lines = stol(number);
+    i += used;
+    return true;
+}
+
+bool GrepCommand::nextMatch(const GrepPattern &pattern, const char *pos, const char *end, const char *&line_begin,
+                            const char *&line_end) {
+    if (pattern.isLiteral()) {
+        // the rest of the block is searched at once, the line around a hit is found afterwards.
+        const char *hit = findSubstring(pos, end - pos, pattern.text().data(), pattern.text().size());
+        if (hit == nullptr)
+            return false;
+        const char *newline_before = static_cast<const char *>(memrchr(pos, '\n', hit - pos));
+        line_begin = (newline_before == nullptr) ? pos : newline_before + 1;
+        const char *newline = static_cast<const char *>(memchr(hit, '\n', end - hit));
+        line_end = (newline == nullptr) ? end : newline + 1;
+        return true;
+    }
+    while (pos < end) {
+        const char *newline = static_cast<const char *>(memchr(pos, '\n', end - pos));
+        const char *next = (newline == nullptr) ? end : newline + 1;
+        if (pattern.matches(pos, (newline == nullptr ? end : newline) - pos)) {
+            line_begin = pos;
+            line_end = next;
+            return true;
         }
+        pos = next;
     }
-    // TODO : we need to deal with deleting quit command itself before exiting.
-    delete this;
-    exit(0);
+    return false;
 }
 
-// ***********************************************************************************************************************************
-// **********************************                EXTERNAL EXECUTE                 ************************************************
-// ***********************************************************************************************************************************
+void GrepCommand::printLines(const char *begin, const char *end) {
+    if (begin == end || count_only)
+        return;
+    if (!line_numbers && prefix.empty()) {
+        cout.write(begin, end - begin);
+    } else {
+        line_number += countByte(counted_to, begin - counted_to, '\n');
+        for (const char *line = begin; line < end; line_number++) {
+            const char *newline = static_cast<const char *>(memchr(line, '\n', end - line));
+            const char *next = (newline == nullptr) ? end : newline + 1;
+            cout << prefix;
+            if (line_numbers)
+                cout << line_number << ':';
+            cout.write(line, next - line);
+            line = next;
+        }
+        counted_to = end;
+    }
+    // the last line of a file may have no newline.
+    if (end[-1] != '\n')
+        cout << '\n';
+}
 
-void ExternalCommand::execute() {
+long GrepCommand::search(int fd, const GrepPattern &pattern) {
+    LineBlockReader reader(fd);
+    const char *data;
+    size_t length;
+    long selected = 0;
+    line_number = 1;
+    while (reader.next(data, length)) {
+        const char *pos = data, *end = data + length;
+        counted_to = data;
+        while (pos < end) {
+            const char *line_begin = end, *line_end = end;
+            bool found = nextMatch(pattern, pos, end, line_begin, line_end);
+            // with -v, every line up to the next match is selected at once.
+            const char *begin = invert ? pos : line_begin, *selection_end = invert ? line_begin : line_end;
+            if (begin < selection_end) {
+                selected += countByte(begin, selection_end - begin, '\n') + (selection_end[-1] != '\n');
+                printLines(begin, selection_end);
+            }
+            if (!found)
+                break;
+            pos = line_end;
+        }
+        if (line_numbers)
+            line_number += countByte(counted_to, end - counted_to, '\n');
+    }
+    return reader.failed ? -1 : selected;
+}
 
-    bool is_background = isBackgroundCommand(cmd_line);
+void GrepCommand::execute() {
     SmallShell &smash = SmallShell::getInstance();
-    string cmd_line_with_bg;
-    if (is_background) {
-        cmd_line_with_bg = cmd_line;
-        BuiltInCommand::remove_background_sign(cmd_line);
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    bool ignore_case = false, fixed = false;
+    int first = 1;
+    for (; first < num_of_args && args[first].size() > 1 && args[first][0] == '-'; first++) {
+        if (args[first] == "--") {
+            first++;
+            break;
+        }
+        for (size_t i = 1; i < args[first].size(); i++) {
+            char option = args[first][i];
+            if (strchr("vcniF", option) == nullptr) {
+                smashPerror("smash error: grep: invalid arguments");
+                smash.last_status = 2;
+                return;
+            }
+            invert = invert || option == 'v';
+            count_only = count_only || option == 'c';
+            line_numbers = line_numbers || option == 'n';
+            ignore_case = ignore_case || option == 'i';
+            fixed = fixed || option == 'F';
+        }
     }
-    char *cmd_str = new char[COMMAND_ARGS_MAX_LENGTH];
-    strcpy(cmd_str, cmd_line.c_str());
-
-    int pid = fork();
+    if (first == num_of_args) {
+        smashPerror("smash error: grep: not enough arguments");
+        smash.last_status = 2;
+        return;
+    }
+    GrepPattern pattern;
+    if (!pattern.compile(args[first], ignore_case, fixed)) {
+        smashPerror("smash error: grep: invalid pattern");
+        smash.last_status = 2;
+        return;
+    }
+    vector<string> inputs = filterInputs(args, first + 1);
+    bool any_selected = false, failed = false;
+    for (const string &input : inputs) {
+        int fd = openFilterInput(input);
+        if (fd == -1) {
+            failed = true;
+            continue;
+        }
+        prefix = (inputs.size() > 1) ? input + ":" : "";
+        long selected = search(fd, pattern);
+        closeFilterInput(input, fd);
+        failed = failed || selected < 0;
+        any_selected = any_selected || selected > 0;
+        if (count_only && selected >= 0)
+            cout << prefix << selected << '\n';
+    }
+    smash.last_status = failed ? 2 : (any_selected ? 0 : 1);
+}
 
-    if (pid < 0) {
-        perror("smash error: fork failed");
-        delete[] cmd_str;
-        return;
-    } else if (pid == 0) {
-        setpgrp();
-        char *argv[] = {(char *) "/bin/bash", (char *) "-c", cmd_str, nullptr};
-        if (execv(argv[0], argv) < 0) {
-            perror("smash error: execv failed");
-            delete[] cmd_str;
+void WcCommand::execute() {
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    bool count_lines = false, count_words = false, count_bytes = false;
+    int first = 1;
+    for (; first < num_of_args && args[first].size() > 1 && args[first][0] == '-'; first++) {
+        if (args[first].find_first_not_of("lwc", 1) != string::npos) {
+            smashPerror("smash error: wc: invalid arguments");
             return;
         }
-    } else {
-        if (this->is_time_out)
-            smash.time_out_list.add_entry(cmd_line, un_proccessed_cmd, pid, kill_time, time(nullptr), is_background);
-
-        if (is_background) {
-            cmd_line = cmd_line_with_bg;
-            smash.jobs.addJob(this, pid, false);
+        count_lines = count_lines || args[first].find('l') != string::npos;
+        count_words = count_words || args[first].find('w') != string::npos;
+        count_bytes = count_bytes || args[first].find('c') != string::npos;
+    }
+    if (!count_lines && !count_words && !count_bytes)
+        count_lines = count_words = count_bytes = true;
+
+    vector<string> inputs = filterInputs(args, first);
+    vector<vector<size_t>> rows;
+    vector<string> names;
+    vector<size_t> total(3, 0);
+    bool all_files = true;
+    for (const string &input : inputs) {
+        int fd = openFilterInput(input);
+        if (fd == -1)
+            continue;
+        vector<size_t> counts(3, 0);
+        struct stat st {};
+        bool regular = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+        all_files = all_files && regular;
+        if (regular && !count_lines && !count_words && lseek(fd, 0, SEEK_CUR) == 0) {
+            // the size of a file is known without reading it.
+            counts[2] = st.st_size;
         } else {
-            smash.current_fg_pid = pid;
-            smash.curr_fg_command = this;
-            waitpid(pid, nullptr, 0 | WUNTRACED);
-            smash.current_fg_pid = -1;
-            smash.curr_fg_command = nullptr;
+            LineBlockReader reader(fd);
+            const char *data;
+            size_t length;
+            bool in_word = false;
+            while (reader.next(data, length)) {
+                if (count_lines)
+                    counts[0] += countByte(data, length, '\n');
+                if (count_words)
+                    counts[1] += countWords(data, length, in_word);
+                counts[2] += length;
+            }
         }
+        closeFilterInput(input, fd);
+        for (int i = 0; i < 3; i++)
+            total[i] += counts[i];
+        rows.push_back(counts);
+        names.push_back(input == "-" ? "" : input);
     }
+    if (rows.size() > 1) {
+        rows.push_back(total);
+        names.push_back("total");
+    }
+    // the columns are as wide as the biggest number. a count of a pipe may be any size, so it gets room for 7 digits.
+    bool columns[3] = {count_lines, count_words, count_bytes};
+    int num_of_columns = count_lines + count_words + count_bytes;
+    size_t width = (num_of_columns == 1 && rows.size() == 1) ? 1 : (all_files ? 1 : 7);
+    for (int i = 0; i < 3; i++) {
+        if (columns[i])
+            width = max(width, to_string(total[i]).size());
+    }
+    for (size_t row = 0; row < rows.size(); row++) {
+        bool first_column = true;
+        for (int i = 0; i < 3; i++) {
+            if (!columns[i])
+                continue;
+            string number = to_string(rows[row][i]);
+            cout << (first_column ? "" : " ") << string(width - min(width, number.size()), ' ') << number;
+            first_column = false;
+        }
+        cout << (names[row].empty() ? "" : " ") << names[row] << '\n';
+    }
+}
 
-    delete[] cmd_str;
+void HeadCommand::execute() {
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    long lines = FILTER_DEFAULT_LINES;
+    int first = 1;
+    bool valid = true;
+    while (first < num_of_args && lineCountOption(args, first, lines, valid) && valid) {
+    }
+    if (!valid || (first < num_of_args && args[first].size() > 1 && args[first][0] == '-')) {
+        smashPerror("smash error: head: invalid arguments");
+        return;
+    }
+    vector<string> inputs = filterInputs(args, first);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        int fd = openFilterInput(inputs[i]);
+        if (fd == -1)
+            continue;
+        if (inputs.size() > 1)
+            cout << (i == 0 ? "" : "\n") << "==> " << inputs[i] << " <==\n";
+        LineBlockReader reader(fd);
+        const char *data;
+        size_t length;
+        long remaining = lines;
+        while (remaining > 0 && reader.next(data, length)) {
+            const char *end = data + length;
+            // a block with fewer lines than are still needed is printed whole, without looking for them.
+            long block_lines = countByte(data, length, '\n');
+            if (block_lines < remaining) {
+                remaining -= block_lines;
+            } else {
+                end = data;
+                for (; remaining > 0; remaining--)
+                    end = static_cast<const char *>(memchr(end, '\n', data + length - end)) + 1;
+            }
+            cout.write(data, end - data);
+        }
+        closeFilterInput(inputs[i], fd);
+    }
 }
 
-// ***********************************************************************************************************************************
-// **********************************                SPECIAL EXECUTE                 *************************************************
-// ***********************************************************************************************************************************
+size_t TailCommand::lastLinesStart(const char *data, size_t length, long n) {
+    if (n == 0)
+        return length;
+    // the newline which ends the last line does not start a line.
+    size_t end = (length > 0 && data[length - 1] == '\n') ? length - 1 : length;
+    for (long i = 0; i < n; i++) {
+        const char *newline = static_cast<const char *>(memrchr(data, '\n', end));
+        if (newline == nullptr)
+            return 0;
+        end = newline - data;
+    }
+    return end + 1;
+}
 
-void RedirectionCommand::execute() {
-    int flags = 0, red_pos = 0;
-    string file_name;
-    red_pos = cmd_line.find_first_of('>');
-    if (first_redirection) {
-        flags = O_RDWR | O_CREAT | O_TRUNC;
-        file_name = both_trim(cmd_line.substr(red_pos + 1));
-    } else if (second_redirection) {
-        flags = O_RDWR | O_CREAT | O_APPEND;
-        file_name = both_trim(cmd_line.substr(red_pos + 2));
+off_t TailCommand::fileLinesStart(int fd, off_t size, long n) {
+    if (n == 0)
+        return size;
+    vector<char> chunk(TEXT_BLOCK_SIZE);
+    off_t pos = size;
+    bool last_chunk = true;
+    while (pos > 0) {
+        size_t count = min((off_t) chunk.size(), pos);
+        pos -= count;
+        if (pread(fd, chunk.data(), count, pos) != (ssize_t) count) {
+            smashPerror("smash error: read failed");
+            return 0;
+        }
+        size_t end = count;
+        if (last_chunk && chunk[end - 1] == '\n')
+            end--;
+        last_chunk = false;
+        for (; n > 0; n--) {
+            const char *newline = static_cast<const char *>(memrchr(chunk.data(), '\n', end));
+            if (newline == nullptr)
+                break;
+            end = newline - chunk.data();
+        }
+        if (n == 0)
+            return pos + end + 1;
     }
-    string actual_command = both_trim(cmd_line.substr(0, red_pos));
-    int return_value, fd, tmp_stdout;
+    return 0;
+}
 
-    // switch between stdout to user file.
-    SYS_CALL(fd, open(file_name.c_str(), flags, S_IRUSR | S_IWUSR | S_IWGRP | S_IRGRP | S_IROTH | S_IWOTH));
-    SYS_CALL(tmp_stdout, dup(STDOUT_FILENO));
-    SYS_CALL(return_value, close(STDOUT_FILENO));
-    SYS_CALL(return_value, dup(fd));
+void TailCommand::follow(int fd, const string &path) {
+    SmallShell &smash = SmallShell::getInstance();
+    cout.flush();
+    int pid = fork();
+    if (pid < 0) {
+        smashPerror("smash error: fork failed");
+        return;
+    }
+    if (pid == 0) {
+        smash.event_loop.reinitAfterFork();
+        setpgid(0, 0);
+        int inotify_fd = inotify_init1(IN_CLOEXEC);
+        if (inotify_fd == -1 || inotify_add_watch(inotify_fd, path.c_str(), IN_MODIFY | IN_ATTRIB) == -1) {
+            smashPerror("smash error: tail: inotify failed");
+            _exit(1);
+        }
+        vector<char> buffer(TEXT_BLOCK_SIZE);
+        // every event is only a hint to read what is new, so they are never looked at one by one.
+        while (read(inotify_fd, buffer.data(), buffer.size()) > 0 || errno == EINTR) {
+            struct stat st {};
+            if (fstat(fd, &st) == 0 && st.st_size < lseek(fd, 0, SEEK_CUR)) {
+                cerr << "smash: tail: " << path << ": file truncated" << endl;
+                lseek(fd, 0, SEEK_SET);
+            }
+            ssize_t count;
+            while ((count = read(fd, buffer.data(), buffer.size())) > 0)
+                cout.write(buffer.data(), count);
+            cout.flush();
+        }
+        smashPerror("smash error: read failed");
+        _exit(1);
+    }
+    // waited for like an external command in the foreground.
+    smash.current_fg_pid = pid;
+    smash.curr_fg_command = this;
+    int status = smash.event_loop.waitForeground(pid);
+    smash.last_status = exitCodeOf(status);
+    if (WIFSTOPPED(status) && smash.jobs.getJobByPId(pid) == nullptr)
+        smash.jobs.addJob(this, pid, true);
+    smash.current_fg_pid = -1;
+    smash.curr_fg_command = nullptr;
+}
 
-    SmallShell::getInstance().executeCommand(actual_command);
+void TailCommand::execute() {
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    long lines = FILTER_DEFAULT_LINES;
+    bool follow_file = false, valid = true;
+    int first = 1;
+    while (first < num_of_args && valid) {
+        if (args[first] == "-f") {
+            follow_file = true;
+            first++;
+        } else if (!lineCountOption(args, first, lines, valid)) {
+            break;
+        }
+    }
+    if (!valid || num_of_args - first > 1 || (first < num_of_args && args[first].size() > 1 && args[first][0] == '-')) {
+        smashPerror("smash error: tail: invalid arguments");
+        return;
+    }
+    string input = (first < num_of_args) ? args[first] : "-";
+    int fd = openFilterInput(input);
+    if (fd == -1)
+        return;
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (lseek(fd, fileLinesStart(fd, st.st_size, lines), SEEK_SET) != -1) {
+            LineBlockReader reader(fd);
+            const char *data;
+            size_t length;
+            while (reader.next(data, length))
+                cout.write(data, length);
+        }
+        // a pipe has no end to wait at, so -f only follows files.
+        if (follow_file)
+            follow(fd, input == "-" ? "/dev/stdin" : input);
+    } else {
+        // only the last lines are kept. they are cut down whenever enough has piled up.
+        string kept;
+        LineBlockReader reader(fd);
+        const char *data;
+        size_t length;
+        while (reader.next(data, length)) {
+            kept.append(data, length);
+            if (kept.size() > 4 * TEXT_BLOCK_SIZE)
+                kept.erase(0, lastLinesStart(kept.data(), kept.size(), lines));
+        }
+        kept.erase(0, lastLinesStart(kept.data(), kept.size(), lines));
+        cout << kept;
+    }
+    closeFilterInput(input, fd);
+}
 
-    // switch back to stdout.
-    SYS_CALL(return_value, dup2(tmp_stdout, STDOUT_FILENO));
-    SYS_CALL(return_value, close(fd));
-    SYS_CALL(return_value, close(tmp_stdout));
+bool SortCommand::parseKey(const string &key, SortKeys &keys, bool &own_options) {
+    unsigned int fields[2] = {0, 0};
+    size_t pos = 0;
+    for (int i = 0; i < 2; i++) {
+        size_t digits_end = min(key.find_first_not_of("0123456789", pos), key.size());
+        if (digits_end == pos || digits_end - pos > 9 || (fields[i] = stoul(key.substr(pos, digits_end - pos))) == 0)
+            return false;
+        for (pos = digits_end; pos < key.size() && (key[pos] == 'n' || key[pos] == 'r'); pos++) {
+            keys.numeric = keys.numeric || key[pos] == 'n';
+            keys.reverse = keys.reverse || key[pos] == 'r';
+            own_options = true;
+        }
+        if (i == 1 || pos == key.size() || key[pos] != ',')
+            break;
+        pos++;
+    }
+    keys.first_field = fields[0];
+    keys.last_field = fields[1];
+    return pos == key.size();
 }
 
-void CatCommand::execute() {
+void SortCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
     vector<string> args;
-    remove_background_sign(cmd_line);
-    int num_of_args = parseCommandLine(cmd_line, args);
-    if (num_of_args == 1) {
-        perror("smash error: cat: not enough arguments");
+    int num_of_args = getArgs(args);
+    SortKeys keys;
+    size_t memory_limit = SORT_MEMORY_DEFAULT;
+    unsigned int threads = ParallelCommand::cpuCount();
+    bool numeric = false, reverse = false, key_options = false, verbose = false, valid = true;
+    int first = 1;
+    for (; valid && first < num_of_args && args[first].size() > 1 && args[first][0] == '-'; first++) {
+        if (args[first] == "--") {
+            first++;
+            break;
+        }
+        char option = args[first][1];
+        if (strchr("tkSP", option) != nullptr) {
+            // the value is the rest of the word, or the next word.
+            string value = args[first].substr(2);
+            if (value.empty() && first + 1 < num_of_args)
+                value = args[++first];
+            if (option == 't') {
+                valid = (value.size() == 1);
+                keys.separator = valid ? (unsigned char) value[0] : -1;
+            } else if (option == 'k') {
+                valid = parseKey(value, keys, key_options);
+            } else {
+                char *end;
+                unsigned long long number = strtoull(value.c_str(), &end, 10);
+                valid = !value.empty() && isdigit(value[0]) && number > 0;
+                if (option == 'P') {
+                    valid = valid && *end == '\0' && number <= 1024;
+                    threads = number;
+                    continue;
+                }
+                int shift = (*end == 'K') ? 10 : (*end == 'M') ? 20 : (*end == 'G') ? 30 : 0;
+                valid = valid && (*end == '\0' || (shift != 0 && end[1] == '\0')) && number <= (SIZE_MAX >> shift);
+                memory_limit = number << shift;
+            }
+            continue;
+        }
+        for (size_t i = 1; valid && i < args[first].size(); i++) {
+            char flag = args[first][i];
+            valid = strchr("nruv", flag) != nullptr;
+            numeric = numeric || flag == 'n';
+            reverse = reverse || flag == 'r';
+            keys.unique = keys.unique || flag == 'u';
+            verbose = verbose || flag == 'v';
+        }
+    }
+    if (!valid) {
+        smashPerror("smash error: sort: invalid arguments");
+        smash.last_status = 2;
         return;
     }
+    // like in sort, -n and -r are for the whole lines, and for the key unless it has options of its own.
+    keys.reverse_lines = reverse;
+    if (!key_options) {
+        keys.numeric = keys.numeric || numeric;
+        keys.reverse = reverse;
+    }
 
-    // start with 1 to skip the cat command itself.
-    for (int i = 1; i < num_of_args; i++) {
-        int fd = 0;
-        // try to open current file.
-        if ((fd = open(args[i].c_str(), O_RDONLY)) == -1) {
-            perror("smash error: open failed");
-            continue;
+    struct timespec start {}, end {};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ExternalSorter sorter(keys, memory_limit, threads, ParallelCommand::openCaptureFile);
+    bool failed = false;
+    for (const string &input : filterInputs(args, first)) {
+        int fd = openFilterInput(input);
+        if (fd == -1) {
+            failed = true;
+            break;
         }
-        ssize_t input_read = 0;
-        // start reading and writing.
-        while (true) {
-            char buff[BUFFER_SIZE];
-            if ((input_read = read(fd, buff, BUFFER_SIZE)) == -1) {
-                perror("smash error: read failed");
-                break;
-            }
-            // when we finish the file, input read will be 0 so break thw while and move to next file.
-            if (input_read == 0)
-                break;
+        LineBlockReader reader(fd);
+        const char *data;
+        size_t length;
+        // sort runs inside smash, so running out of memory fails the sort and not the shell.
+        try {
+            while (!failed && reader.next(data, length))
+                failed = !sorter.add(data, length);
+        } catch (const bad_alloc &) {
+            errno = ENOMEM;
+            smashPerror("smash error: sort: out of memory");
+            failed = true;
+        }
+        failed = failed || reader.failed;
+        closeFilterInput(input, fd);
+    }
+    // like sort, nothing is printed when some input could not be read.
+    try {
+        failed = failed || !sorter.finish(cout);
+    } catch (const bad_alloc &) {
+        errno = ENOMEM;
+        smashPerror("smash error: sort: out of memory");
+        failed = true;
+    }
+    if (failed) {
+        smash.last_status = 2;
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (verbose) {
+        const SortStats &stats = sorter.stats;
+        double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        cerr << "smash: sort: " << stats.lines << " lines (" << stats.bytes << " bytes) in " << fixed
+             << setprecision(6) << elapsed << " secs, " << stats.runs << " runs spilled (" << stats.spilled_bytes
+             << " bytes), peak memory " << stats.peak_memory << " bytes, " << stats.threads << " threads" << endl;
+    }
+    smash.last_status = 0;
+}
 
-            if (write(STDOUT_FILENO, buff, input_read) == -1) {
-                perror("smash error: write failed");
-                break;
-            }
+// external stages are launched directly, builtins run in a forked smash. every stage joins the given process group.
+int PipeCommand::launchStage(unsigned int stage, const vector<pair<int, int>> &dup_fds, const vector<int> &close_fds,
+                             int process_group) {
+    SmallShell &smash = SmallShell::getInstance();
+    Command *cmd = smash.CreateSimpleCommand(*parsed, parsed->stages[stage].first_token, parsed->stages[stage].end_token,
+                                             stage);
+    cmd->un_proccessed_cmd = cmd->cmd_line;
+    ExternalCommand *external_cmd = dynamic_cast<ExternalCommand *>(cmd);
+    if (external_cmd != nullptr) {
+        LaunchSpec spec;
+        // set first, so the substitutions of the stage do not get the pipes of the pipeline.
+        spec.close_fds = close_fds;
+        if (!external_cmd->prepareLaunch(spec))
+            return -1;
+        spec.dup_fds.insert(spec.dup_fds.end(), dup_fds.begin(), dup_fds.end());
+        spec.process_group = process_group;
+        int pid = smash.launcher.launch(spec);
+        substitution_pids.insert(substitution_pids.end(), cmd->substitution_pids.begin(), cmd->substitution_pids.end());
+        return pid;
+    }
 
+    vector<FdAction> actions;
+    vector<int> body_fds;
+    if (!cmd->redirectionActions(actions, body_fds))
+        return -1;
+    // the forked smash would print whatever is still buffered a second time.
+    cout.flush();
+    int pid = fork();
+    if (pid != 0) {
+        for (int fd : body_fds)
+            close(fd);
+    }
+    if (pid < 0) {
+        smashPerror("smash error: fork failed");
+        return -1;
+    }
+    if (pid == 0) {
+        smash.event_loop.reinitAfterFork();
+        setpgid(0, process_group);
+        for (auto &fds : dup_fds) {
+            if (dup2(fds.first, fds.second) == -1) {
+                smashPerror("smash error: dup2 failed");
+                _exit(1);
+            }
+        }
+        if (!Launcher::applyFdActions(actions))
+            _exit(1);
+        for (int fd : close_fds)
+            close(fd);
+        vector<pair<int, int>> substitutions;
+        if (!cmd->startSubstitutions(substitutions))
+            _exit(1);
+        for (auto &fds : substitutions) {
+            dup2(fds.first, fds.second);
+            close(fds.first);
         }
-        if (close(fd) == -1)
-            perror("smash error: close failed");
+        // the stage's status is what the builtin reports, for pipestatus and pipefail. the forked smash leaves with
+        // _exit, so smash's own objects (history, jobs, the arena) are not torn down a second time.
+        smash.last_status = 0;
+        cmd->execute();
+        cout.flush();
+        _exit(smash.last_status);
     }
+    return pid;
 }
 
 void PipeCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    vector<Stage> &stages = parsed->stages;
+    unsigned int num_of_stages = stages.size();
+    // the pipes are close-on-exec, so only the ends a stage gets with dup2 outlive its exec, and no other process
+    // smash launches holds a write end open.
+    vector<int> pipe_fds;
+    for (unsigned int i = 0; i + 1 < num_of_stages; i++) {
+        int new_pipe[2];
+        if (pipe2(new_pipe, O_CLOEXEC) == -1) {
+            smashPerror("smash error: pipe failed");
+            for (int fd : pipe_fds)
+                close(fd);
+            return;
+        }
+        pipe_fds.push_back(new_pipe[0]);
+        pipe_fds.push_back(new_pipe[1]);
+    }
 
-    int new_pipe[2], fd = 0, return_value;
-    SYS_CALL(return_value, pipe(new_pipe));
-
-    int left_command_pid = -1;
-    int right_command_pid = -1;
-    int del_pos = cmd_line.find_first_of('|');
-    string left_command = both_trim(cmd_line.substr(0, del_pos));
-    string right_command;
-    if (first_pipe)
-        right_command = both_trim(cmd_line.substr(del_pos + 1));
-    else if (second_pipe)
-        right_command = both_trim(cmd_line.substr(del_pos + 2));
-
-    SYS_CALL(left_command_pid, fork());
-    if (left_command_pid == 0) {
-        setpgrp();
-        if (second_pipe)
-            fd = STDERR_FILENO;
-        else
-            fd = STDOUT_FILENO;
-
-        SYS_CALL(return_value, close(fd));
-        SYS_CALL(return_value, close(new_pipe[0]));
-        SYS_CALL(return_value, dup(new_pipe[1]));
-        SYS_CALL(return_value, close(new_pipe[1]));
-        SmallShell::getInstance().executeCommand(left_command);
-        SYS_CALL(return_value, close(fd));
-        exit(0);
-    } else {
-        SYS_CALL(right_command_pid, fork());
-        if (right_command_pid == 0) {
-            setpgrp();
-            SYS_CALL(return_value, close(new_pipe[1]));
-            SYS_CALL(return_value, close(STDIN_FILENO));
-            SYS_CALL(return_value, dup(new_pipe[0]));
-            SYS_CALL(return_value, close(new_pipe[0]));
-            SmallShell::getInstance().executeCommand(right_command);
-            SYS_CALL(return_value, close(STDIN_FILENO));
-            exit(0);
-        } else {
-            SYS_CALL(return_value, close(new_pipe[0]));
-            SYS_CALL(return_value, close(new_pipe[1]));
-            SYS_CALL(return_value, waitpid(left_command_pid, nullptr, 0));
-            SYS_CALL(return_value, waitpid(right_command_pid, nullptr, 0));
+    // stage i reads from pipe i - 1 and writes to pipe i. the first stage leads the process group of the pipeline.
+    vector<int> pids(num_of_stages, -1);
+    int process_group = 0;
+    for (unsigned int i = 0; i < num_of_stages; i++) {
+        vector<pair<int, int>> dup_fds;
+        if (i > 0)
+            dup_fds.push_back({pipe_fds[2 * (i - 1)], STDIN_FILENO});
+        if (i + 1 < num_of_stages)
+            dup_fds.push_back({pipe_fds[2 * i + 1], stages[i].stderr_pipe ? STDERR_FILENO : STDOUT_FILENO});
+        pids[i] = launchStage(i, dup_fds, pipe_fds, process_group);
+        if (pids[i] < 0)
+            break;
+        if (process_group == 0)
+            process_group = pids[i];
+    }
+    for (int fd : pipe_fds)
+        close(fd);
+
+    vector<int> launched_pids, statuses;
+    vector<struct rusage> usages;
+    for (int pid : pids) {
+        if (pid > 0)
+            launched_pids.push_back(pid);
+    }
+    // a background pipeline is one job, known by the first stage, which leads the group of every stage. the job is done
+    // when the first stage is. the other stages and the substitutions are left to the reaper.
+    if (parsed->background) {
+        if (process_group != 0)
+            smash.jobs.addJob(this, process_group, false);
+        waitSubstitutions(true);
+        return;
+    }
+    // ctrl-C and ctrl-Z go to the whole process group, which the first stage leads.
+    if (process_group != 0) {
+        smash.current_fg_pid = process_group;
+        smash.curr_fg_command = this;
+    }
+    smash.event_loop.watchForeground(substitution_pids, true);
+    smash.event_loop.waitForeground(launched_pids, statuses, &usages);
+    bool stopped = false;
+    for (int stage_status : statuses)
+        stopped = stopped || WIFSTOPPED(stage_status);
+    waitSubstitutions(stopped);
+    // stopped by a signal from outside smash (ctrl-Z adds the job itself).
+    if (stopped && smash.jobs.getJobByPId(process_group) == nullptr)
+        smash.jobs.addJob(this, process_group, true);
+    smash.current_fg_pid = -1;
+    smash.curr_fg_command = nullptr;
+    // a stage which could not be launched counts as command not found.
+    smash.pipe_statuses.assign(num_of_stages, 127);
+    for (unsigned int i = 0; i < launched_pids.size(); i++) {
+        smash.pipe_statuses[i] = exitCodeOf(statuses[i]);
+        if (!WIFSTOPPED(statuses[i]))
+            smash.logUsage(parsed->rawText(stages[i].first_token, stages[i].end_token), launched_pids[i], statuses[i],
+                           usages[i]);
+    }
+    // with pipefail the status is the one of the last stage that failed.
+    smash.last_status = smash.pipe_statuses.back();
+    if (smash.pipefail) {
+        for (int stage_status : smash.pipe_statuses) {
+            if (stage_status != 0)
+                smash.last_status = stage_status;
         }
     }
 }
 
 void TimeOutCommand::execute() {
     vector<string> args;
-    string un_proccessed_cmd = cmd_line; // this is used only for printing.
-    int num_of_args = parseCommandLine(cmd_line, args);
+    int num_of_args = getArgs(args);
     if (num_of_args < 3) {
-        perror("smash error: timeout: invalid arguments");
+        smashError("smash error: timeout: invalid arguments");
         return;
     }
 
-    bool check_if_duration_is_int = (args[1].find_first_not_of("0123456789") == std::string::npos);
-    if (!check_if_duration_is_int) {
-        perror("smash error: timeout: invalid arguments");
+    // the duration is in seconds and may have a fraction (timeout 0.25 ...). the whole seconds are bounded so the
+    // duration in nanoseconds fits a long long.
+    bool check_if_duration_is_num = (args[1].find_first_not_of("0123456789.") == std::string::npos) &&
+                                    (args[1].find_first_of("0123456789") != std::string::npos) &&
+                                    (args[1].find('.') == args[1].rfind('.')) &&
+                                    (args[1].find('.') == std::string::npos ? args[1].size() : args[1].find('.')) < 10;
+    if (!check_if_duration_is_num) {
+        smashError("smash error: timeout: invalid arguments");
         return;
     }
     SmallShell &smash = SmallShell::getInstance();
-    string new_cmd_str;
-    for (int i = 2; i < num_of_args; i++)
-        new_cmd_str += args[i] + " ";
-
-    new_cmd_str = both_trim(new_cmd_str);
-    Command *new_cmd = smash.CreateCommand(new_cmd_str);
+    // the command starts at the third word of the line.
+    unsigned int inner_first = parsed->nextWord(first_token, end_token);
+    inner_first = parsed->nextWord(inner_first + 1, end_token);
+    inner_first = parsed->nextWord(inner_first + 1, end_token);
+    Command *new_cmd = smash.CreateSimpleCommand(*parsed, inner_first, end_token);
 
     new_cmd->is_time_out = true;
-    new_cmd->kill_time = stoi(args[1]);
+    new_cmd->kill_time = (long long) (stod(args[1]) * 1e9);
+    new_cmd->placement = placement;
+    new_cmd->limits = limits;
+    new_cmd->un_proccessed_cmd = un_proccessed_cmd; // this is used only for printing.
+    new_cmd->execute();
+}
+unsigned int ParallelCommand::cpuCount() {
+    // the cpus smash may run on, which is less than the whole machine under taskset or a cpuset.
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0)
+        return CPU_COUNT(&cpus);
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? online : 1;
+}
+
+// an unnamed file in $TMPDIR, gone as soon as it is closed.
+int ParallelCommand::openCaptureFile() {
+    const char *tmp_dir = getenv("TMPDIR");
+    string dir = (tmp_dir != nullptr && *tmp_dir != '\0') ? tmp_dir : "/tmp";
+    int fd = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd != -1)
+        return fd;
+    // file systems without O_TMPFILE get a named file which is unlinked right away.
+    string path = dir + "/smash-parallel-XXXXXX";
+    if ((fd = mkostemp(&path[0], O_CLOEXEC)) == -1) {
+        smashPerror("smash error: mkostemp failed");
+        return -1;
+    }
+    unlink(path.c_str());
+    return fd;
+}
+
+int ParallelCommand::launchJob(ParallelJob &job, bool keep_order) {
+    string command = job.command;
+    ExternalCommand cmd(command);
+    // a single simple command is launched directly, with its redirections. anything else (pipes, &) goes through bash.
+    if (job_line.parse(command) && job_line.stages.size() == 1 && !job_line.background) {
+        cmd.parsed = &job_line;
+        cmd.first_token = job_line.stages[0].first_token;
+        cmd.end_token = job_line.stages[0].end_token;
+        cmd.stage = 0;
+    }
+    LaunchSpec spec;
+    if (!cmd.prepareLaunch(spec))
+        return -1;
+    if (keep_order) {
+        if ((job.output_fd = openCaptureFile()) == -1)
+            return -1;
+        spec.dup_fds.push_back({job.output_fd, STDOUT_FILENO});
+    }
+    return SmallShell::getInstance().launcher.launch(spec);
+}
+
+void ParallelCommand::printJob(unsigned int seq, ParallelJob &job, bool verbose) {
+    if (job.output_fd != -1) {
+        cout << flush;
+        CopyMethod method;
+        if (lseek(job.output_fd, 0, SEEK_SET) == -1)
+            smashPerror("smash error: lseek failed");
+        else
+            CatCommand::copyFd(job.output_fd, SmallShell::getInstance().std_fds[STDOUT_FILENO], BUFFER_SIZE, method);
+        if (close(job.output_fd) == -1)
+            smashPerror("smash error: close failed");
+        job.output_fd = -1;
+    }
+    if (verbose) {
+        double elapsed = (job.end_time - job.start_time) / 1e9;
+        cerr << "smash: parallel: [" << seq << "]" << job.command << " : exit " << exitCodeOf(job.status) << " in "
+             << fixed << setprecision(6) << elapsed << " secs" << endl;
+    }
+}
+
+// the next line of the input with any text, false when the input has ended.
+static bool nextJobLine(InputReader &input, string &line) {
+    LineView view {};
+    while (true) {
+        while (!input.nextLine(view)) {
+            if (input.ended())
+                return false;
+            input.fill();
+        }
+        line.assign(view.data, view.length);
+        if (line.find_first_not_of(WHITESPACE) != string::npos)
+            return true;
+    }
+}
+
+static string jobCommand(const string &command_template, const string &line) {
+    if (command_template.empty())
+        return line;
+    size_t pos = command_template.find("{}");
+    if (pos == string::npos)
+        return command_template + " " + line;
+    string command = command_template;
+    for (; pos != string::npos; pos = command.find("{}", pos + line.size()))
+        command.replace(pos, 2, line);
+    return command;
+}
+
+int ParallelCommand::runJobs(InputReader &input, const string &command_template, unsigned int slots, bool keep_order,
+                             bool verbose) {
+    SmallShell &smash = SmallShell::getInstance();
+    // jobs by their place in the input, from when they are launched until they are printed.
+    map<unsigned int, ParallelJob> launched;
+    vector<int> running_pids;
+    vector<unsigned int> running_seqs;
+    unsigned int next_seq = 1;
+    int failed = 0;
+    bool input_left = true;
+    string line;
+    while (true) {
+        // keep every slot busy while there is input.
+        while (input_left && running_pids.size() < slots) {
+            if (!nextJobLine(input, line)) {
+                input_left = false;
+                break;
+            }
+            ParallelJob &job = launched[next_seq];
+            job.command = jobCommand(command_template, line);
+            job.start_time = TimeOutList::now();
+            job.pid = launchJob(job, keep_order);
+            if (job.pid < 0) {
+                // a job which could not be launched counts as command not found.
+                job.end_time = TimeOutList::now();
+                job.done = true;
+                job.status = 127 << 8;
+            } else {
+                running_pids.push_back(job.pid);
+                running_seqs.push_back(next_seq);
+            }
+            next_seq++;
+        }
+
+        if (!running_pids.empty()) {
+            int status;
+            unsigned int index = smash.event_loop.waitForegroundAny(running_pids, status);
+            // a job stopped from outside smash still holds its slot until it is continued and done.
+            if (WIFSTOPPED(status))
+                continue;
+            ParallelJob &job = launched[running_seqs[index]];
+            job.end_time = TimeOutList::now();
+            job.done = true;
+            job.status = status;
+            running_pids[index] = running_pids.back();
+            running_pids.pop_back();
+            running_seqs[index] = running_seqs.back();
+            running_seqs.pop_back();
+        }
+
+        // without -k a job is printed as soon as it is done, with -k only once every job before it was printed.
+        for (auto it = launched.begin(); it != launched.end();) {
+            if (!it->second.done) {
+                if (keep_order)
+                    break;
+                ++it;
+                continue;
+            }
+            failed += (exitCodeOf(it->second.status) != 0);
+            printJob(it->first, it->second, verbose);
+            it = launched.erase(it);
+        }
+        if (!input_left && running_pids.empty())
+            return failed;
+    }
+}
+
+void ParallelCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    vector<string> args;
+    int num_of_args = getArgs(args);
+
+    // options: -j <n> jobs at a time (the number of cpus by default), -k prints the output of every job whole and in
+    // input order, -v reports the exit status and run time of every job, -a <file> reads the input from a file.
+    unsigned int slots = cpuCount();
+    bool keep_order = false, verbose = false;
+    string input_file;
+    int first_word = 1;
+    while (first_word < num_of_args &&
+           (args[first_word].compare(0, 2, "-j") == 0 || args[first_word] == "-k" || args[first_word] == "-v" ||
+            args[first_word] == "-a")) {
+        string option = args[first_word++];
+        if (option == "-k" || option == "-v") {
+            (option == "-k" ? keep_order : verbose) = true;
+            continue;
+        }
+        // the value of -j may be glued to it (-j4).
+        string value;
+        if (option.size() > 2) {
+            value = option.substr(2);
+        } else if (first_word < num_of_args) {
+            value = args[first_word++];
+        } else {
+            smashPerror("smash error: parallel: invalid arguments");
+            return;
+        }
+        if (option == "-a") {
+            input_file = value;
+            continue;
+        }
+        bool is_count = !value.empty() && value.find_first_not_of("0123456789") == std::string::npos &&
+                        value.size() < 10 && stoi(value) > 0;
+        if (!is_count) {
+            smashPerror("smash error: parallel: invalid arguments");
+            return;
+        }
+        slots = stoi(value);
+    }
+    // the rest of the line is the command, as typed so its quotes survive.
+    string command_template;
+    if (first_word < num_of_args) {
+        unsigned int template_first = parsed->nextWord(first_token, end_token);
+        for (int i = 0; i < first_word; i++)
+            template_first = parsed->nextWord(template_first + 1, end_token);
+        command_template = parsed->rawText(template_first, end_token);
+    }
+
+    int input_fd = smash.std_fds[STDIN_FILENO];
+    if (!input_file.empty() && (input_fd = open(input_file.c_str(), O_RDONLY | O_CLOEXEC)) == -1) {
+        smashPerror("smash error: open failed");
+        return;
+    }
+    InputReader input;
+    input.open(input_fd);
+
+    if (is_bg) {
+        // the whole run is a single job, in a forked smash.
+        cout.flush();
+        int pid = fork();
+        if (pid < 0) {
+            smashPerror("smash error: fork failed");
+        } else if (pid == 0) {
+            smash.event_loop.reinitAfterFork();
+            setpgid(0, 0);
+            int failed = runJobs(input, command_template, slots, keep_order, verbose);
+            cout.flush();
+            _exit(min(failed, PARALLEL_MAX_FAILED));
+        } else {
+            smash.jobs.addJob(this, pid, false);
+        }
+    } else {
+        smash.last_status = min(runJobs(input, command_template, slots, keep_order, verbose), PARALLEL_MAX_FAILED);
+    }
+    if (!input_file.empty() && close(input_fd) == -1)
+        smashPerror("smash error: close failed");
+}
+
+static double seconds(const struct timeval &time) {
+    return time.tv_sec + time.tv_usec / 1e6;
+}
+
+static void printUsage(const struct rusage &usage) {
+    cerr << fixed << setprecision(3) << "user " << seconds(usage.ru_utime) << "s, sys " << seconds(usage.ru_stime)
+         << "s, maxrss " << usage.ru_maxrss << " KB, ctxsw " << usage.ru_nvcsw << " voluntary " << usage.ru_nivcsw
+         << " involuntary, faults " << usage.ru_minflt << " minor " << usage.ru_majflt << " major" << endl;
+}
+
+void TimeCommand::execute() {
+    SmallShell &smash = SmallShell::getInstance();
+    unsigned int inner_first = parsed->nextWord(parsed->nextWord(first_token, end_token) + 1, end_token);
+    if (inner_first == end_token) {
+        smashPerror("smash error: time: invalid arguments");
+        return;
+    }
+    // the rest of the line as typed, so its pipes, redirections and & work as they would without time.
+    unsigned int text_begin = parsed->tokens[inner_first].begin;
+    // the bodies of here documents follow the command.
+    string inner_line = parsed->line.substr(text_begin, parsed->tokens[end_token - 1].end - text_begin) +
+                        parsed->line.substr(parsed->command_end);
+
+    vector<ProcessUsage> log;
+    vector<ProcessUsage> *outer_log = smash.time_log;
+    smash.time_log = &log;
+    struct rusage self_before {}, self_after {};
+    getrusage(RUSAGE_SELF, &self_before);
+    long long start = TimeOutList::now();
+    smash.executeCommand(inner_line);
+    long long real_ns = TimeOutList::now() - start;
+    getrusage(RUSAGE_SELF, &self_after);
+    smash.time_log = outer_log;
+
+    // smash's own share is what it used while the line ran: builtins, launching, waiting. its maxrss is not a delta.
+    struct rusage self {}, total {};
+    timersub(&self_after.ru_utime, &self_before.ru_utime, &self.ru_utime);
+    timersub(&self_after.ru_stime, &self_before.ru_stime, &self.ru_stime);
+    self.ru_maxrss = self_after.ru_maxrss;
+    self.ru_nvcsw = self_after.ru_nvcsw - self_before.ru_nvcsw;
+    self.ru_nivcsw = self_after.ru_nivcsw - self_before.ru_nivcsw;
+    self.ru_minflt = self_after.ru_minflt - self_before.ru_minflt;
+    self.ru_majflt = self_after.ru_majflt - self_before.ru_majflt;
+    total = self;
+    for (ProcessUsage &process : log) {
+        cerr << "smash: time: [" << process.pid << "]" << process.command << " : exit " << exitCodeOf(process.status)
+             << ", ";
+        printUsage(process.usage);
+        timeradd(&total.ru_utime, &process.usage.ru_utime, &total.ru_utime);
+        timeradd(&total.ru_stime, &process.usage.ru_stime, &total.ru_stime);
+        total.ru_maxrss = max(total.ru_maxrss, process.usage.ru_maxrss);
+        total.ru_nvcsw += process.usage.ru_nvcsw;
+        total.ru_nivcsw += process.usage.ru_nivcsw;
+        total.ru_minflt += process.usage.ru_minflt;
+        total.ru_majflt += process.usage.ru_majflt;
+    }
+    cerr << "smash: time: smash : ";
+    printUsage(self);
+    cerr << "smash: time: real " << fixed << setprecision(3) << real_ns / 1e9 << "s, ";
+    printUsage(total);
+    // a time inside another time is part of the outer one too.
+    if (outer_log != nullptr)
+        outer_log->insert(outer_log->end(), log.begin(), log.end());
+}
+
+void RunCommand::execute() {
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    Placement new_placement = placement;
+    Limits new_limits = limits;
+    int pos = 1;
+    while (pos < num_of_args && args[pos].compare(0, 2, "--") == 0) {
+        if (!new_placement.parseOption(args, pos) && !new_limits.parseOption(args, pos)) {
+            smashPerror("smash error: run: invalid arguments");
+            return;
+        }
+    }
+    if (pos == num_of_args) {
+        smashPerror("smash error: run: invalid arguments");
+        return;
+    }
+    // the command starts at the first word after the options. builtins run in smash itself and are not placed.
+    unsigned int inner_first = parsed->nextWord(first_token, end_token);
+    for (int i = 0; i < pos; i++)
+        inner_first = parsed->nextWord(inner_first + 1, end_token);
+    Command *new_cmd = SmallShell::getInstance().CreateSimpleCommand(*parsed, inner_first, end_token);
+    new_cmd->is_time_out = is_time_out;
+    new_cmd->kill_time = kill_time;
+    new_cmd->placement = new_placement;
+    new_cmd->limits = new_limits;
     new_cmd->un_proccessed_cmd = un_proccessed_cmd;
     new_cmd->execute();
-    delete new_cmd;
-}
\ No newline at end of file
+}
+
+void SchedCommand::execute() {
+    vector<string> args;
+    int num_of_args = getArgs(args);
+    if (num_of_args < 2 || args[1].empty() || args[1].size() > 9 ||
+        args[1].find_first_not_of("0123456789") != string::npos) {
+        smashPerror("smash error: sched: invalid arguments");
+        return;
+    }
+    Placement new_placement;
+    Limits new_limits;
+    int pos = 2;
+    while (pos < num_of_args) {
+        if (!new_placement.parseOption(args, pos) && !new_limits.parseOption(args, pos)) {
+            smashPerror("smash error: sched: invalid arguments");
+            return;
+        }
+    }
+    JobEntry *job = jobs_list->getJobById(stoi(args[1]));
+    if (job == nullptr) {
+        string error_str = "smash error: sched: job-id " + args[1] + " does not exist";
+        smashPerror(error_str.c_str());
+        return;
+    }
+    // without options, what the kernel has for the job now.
+    if (!new_placement.isSet() && !new_limits.isSet()) {
+        Placement current;
+        Limits current_limits;
+        if (!current.read(job->process_id) || !current_limits.read(job->process_id)) {
+            smashPerror("smash error: sched failed");
+            return;
+        }
+        string limits = current_limits.describe();
+        cout << "[" << job->job_id << "]" << job->job_command << " : " << job->process_id << " "
+             << current.describe() << (limits.empty() ? "" : " ") << limits << '\n';
+        return;
+    }
+    // all or nothing. a lowered hard limit can not be raised back, so the limits go last, once reading them showed
+    // smash may set them - lowering a limit smash may read does not fail. a placement which fails halfway is put back
+    // the way it was read.
+    Placement old_placement;
+    Limits old_limits;
+    if (!old_placement.read(job->process_id) || !old_limits.read(job->process_id)) {
+        smashPerror("smash error: sched failed");
+        return;
+    }
+    const char *failed_call = new_placement.apply(job->process_id);
+    if (failed_call != nullptr) {
+        int saved_errno = errno;
+        old_placement.apply(job->process_id);
+        errno = saved_errno;
+        smashPerror((string("smash error: ") + failed_call + " failed").c_str());
+        return;
+    }
+    if (!new_limits.apply(job->process_id)) {
+        int saved_errno = errno;
+        old_placement.apply(job->process_id);
+        errno = saved_errno;
+        smashPerror("smash error: prlimit failed");
+        return;
+    }
+    job->placement.merge(new_placement);
+    job->limits.merge(new_limits);
+}
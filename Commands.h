@@ -5,12 +5,45 @@
 #include <string>
 #include <algorithm>
 #include <list>
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <new>
+#include <utility>
+#include <streambuf>
+#include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "event_loop.h"
+#include "history.h"
+#include "parser.h"
+#include "text_scan.h"
+#include "external_sort.h"
 
 #define COMMAND_ARGS_MAX_LENGTH (200)
 #define COMMAND_MAX_ARGS (20)
 #define PATH_MAX_CD 1024
-#define BUFFER_SIZE 1024
+#define BUFFER_SIZE (128 * 1024) // default size of cat's buffered copy loop.
+#define COPY_CHUNK_SIZE (1 << 30) // how much to ask the kernel to copy in a single zero-copy syscall.
+#define ARENA_BLOCK_SIZE (16 * 1024) // commands of a line are carved out of blocks of this size.
+#define PARALLEL_MAX_FAILED 100 // parallel exits with the number of failed jobs, up to this.
+#define CAPTURE_RING_SIZE (64 * 1024) // default size of a background job's output ring.
+#define FINISHED_OUTPUTS_MAX 8 // how many finished jobs keep their captured output for joblog.
+#define FD_STREAM_BUFFER_SIZE (64 * 1024) // buffer of smash's cout, and of the cout and cerr of a redirected builtin.
+#define REDIRECT_MODE 0666 // files created by a redirection, before the umask.
+#define FILTER_DEFAULT_LINES 10 // how many lines head and tail print without -n.
+#define HERE_PIPE_MAX PIPE_BUF // a here document up to this size is written into a pipe, which never blocks on it.
+
+// the io priority ABI of ioprio_set(2), which glibc has no header for.
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_LEVELS 8
 
 using std::string;
 const string WHITESPACE = " \n\r\t\f\v";
@@ -26,11 +59,100 @@ const string WHITESPACE = " \n\r\t\f\v";
         }                                 \
     } while (0)
 
-static void smash_error(const string &syscall) {
+// perror for smash's own errors. it is counted, so a builtin which printed one exits with status 1.
+void smashPerror(const char *message);
+
+// the same, for an error with no errno behind it (bad arguments).
+void smashError(const char *message);
+
+// the exit status the way a shell reports it - killed by a signal is 128 + the signal number.
+int exitCodeOf(int status);
+
+inline void smash_error(const string &syscall) {
     string error_message = "smash error: " + syscall.substr(0, syscall.find('(')) + " failed";
-    perror(error_message.c_str());
+    smashPerror(error_message.c_str());
 }
 
+// how a process is scheduled and where it may run. anything not set is inherited from smash.
+class Placement {
+public:
+    Placement() : has_cpus(false), has_nice(false), nice(0), io_class(-1), io_level(0), policy(-1) {
+        CPU_ZERO(&cpus);
+    };
+
+    bool has_cpus;
+    cpu_set_t cpus;
+    bool has_nice;
+    int nice;
+    int io_class; // IOPRIO_CLASS_RT, IOPRIO_CLASS_BE or IOPRIO_CLASS_IDLE, -1 when not set.
+    int io_level; // 0 (highest) to 7, for the realtime and best-effort classes.
+    int policy; // SCHED_OTHER, SCHED_BATCH or SCHED_IDLE, -1 when not set.
+
+    bool isSet() const {
+        return has_cpus || has_nice || io_class != -1 || policy != -1;
+    }
+
+    // parses the option at args[pos] (--cpus, --nice, --io or --sched) and its value, and moves pos past them.
+    // returns false when it is not a valid option.
+    bool parseOption(const std::vector<string> &args, int &pos);
+
+    // applies every setting to pid, 0 for the calling process. returns the name of the syscall which failed, or
+    // nullptr when all of them succeeded.
+    const char *apply(int pid) const;
+
+    // reads every setting of pid from the kernel. returns false when pid could not be queried.
+    bool read(int pid);
+
+    // takes every setting other has.
+    void merge(const Placement &other);
+
+    // the settings as run takes them, e.g. "cpus 4-7 nice 10 io idle sched batch". empty when nothing is set.
+    string describe() const;
+};
+
+// resource caps of a process, set with prlimit before exec (or on a running job). 0 means not set.
+class Limits {
+public:
+    rlim_t address_space = 0; // bytes.
+    rlim_t cpu_seconds = 0;
+    rlim_t open_files = 0;
+    rlim_t file_size = 0; // bytes.
+
+    bool isSet() const {
+        return address_space != 0 || cpu_seconds != 0 || open_files != 0 || file_size != 0;
+    }
+
+    // parses the option at args[pos] (--as, --cpu-time, --nofile or --fsize) and its value, and moves pos past them.
+    // sizes may end with K, M or G. returns false when it is not a valid option.
+    bool parseOption(const std::vector<string> &args, int &pos);
+
+    // applies every limit to pid, 0 for the calling process. returns false when one of them failed.
+    bool apply(int pid) const;
+
+    // reads the soft limits of pid. returns false when pid could not be queried.
+    bool read(int pid);
+
+    // takes every limit other has.
+    void merge(const Limits &other);
+
+    // the limits as run takes them, e.g. "as 1G cpu-time 10". empty when nothing is set.
+    string describe() const;
+
+    // which limit a process with these limits hit, given its wait status. only the cpu time and file size limits
+    // kill with a signal of their own, so it is empty for any other exit, as there is no telling.
+    string violation(int status) const;
+};
+
+// a redirection as a child applies it between fork and exec: path is opened onto fd, or without a path source_fd
+// is copied onto fd.
+class FdAction {
+public:
+    int fd;
+    int source_fd;
+    const char *path;
+    int flags;
+};
+
 class Command {
 
 public:
@@ -39,7 +161,40 @@ public:
     string un_proccessed_cmd;
     bool is_time_out = false;
     bool is_bg = false;
-    int kill_time;
+    long long kill_time; // timeout duration in nanoseconds.
+    Placement placement; // applied to the process of an external command before exec.
+    Limits limits; // the same.
+    // where the command is in its parsed line. nullptr for a command made from a plain string.
+    ParsedLine *parsed = nullptr;
+    unsigned int first_token = 0;
+    unsigned int end_token = 0;
+    int stage = -1; // the pipeline stage whose redirections the command applies, -1 for none.
+    std::vector<int> substitution_pids; // the commands of its <(cmd) and >(cmd) words, once they were started.
+
+    // the words of the command with quotes removed. returns their number.
+    int getArgs(std::vector<string> &args) const;
+
+    bool hasRedirections() const {
+        return stage >= 0 && parsed->stages[stage].first_redirection < parsed->stages[stage].end_redirection;
+    }
+
+    // the redirections of the command's stage, the way the child applies them. the input of here documents is put in
+    // fds opened here and added to body_fds, which the caller closes once the child has them. with leave_to_shell,
+    // the redirections bash applies itself (by_shell) are skipped. returns false when an input could not be set up.
+    bool redirectionActions(std::vector<FdAction> &actions, std::vector<int> &body_fds,
+                            bool leave_to_shell = false) const;
+
+    bool hasSubstitutions() const;
+
+    // starts the commands of the substitutions in the command's words, each with one end of a new pipe. the other
+    // ends are added to fds as (end, the fd the command has to get it on). when one cannot be started, the ends of
+    // those already started are closed, which is all they get, and false is returned. the commands do not get
+    // close_fds, the fds smash holds for other processes (the pipes of a pipeline, here document bodies).
+    bool startSubstitutions(std::vector<std::pair<int, int>> &fds, const std::vector<int> &close_fds = {});
+
+    // waits for the commands of the substitutions, once the command has finished. a stopped command leaves them
+    // running in the background.
+    void waitSubstitutions(bool stopped);
 
     virtual ~Command() = default;
 
@@ -57,36 +212,85 @@ public:
     virtual ~BuiltInCommand() = default;
 };
 
+enum LaunchBackend {
+    LAUNCH_FORK, LAUNCH_SPAWN
+};
+
+// everything the child needs before exec: the program, its arguments and the fd setup.
+class LaunchSpec {
+public:
+    string path;
+    std::vector<string> args; // used when argv is empty.
+    std::vector<const char *> argv; // the arguments straight from a parsed line, without the terminating nullptr.
+    std::vector<std::pair<int, int>> dup_fds; // (old fd, new fd) pairs, applied in order.
+    std::vector<FdAction> fd_actions; // the command's own redirections, applied after the dups.
+    std::vector<int> close_fds; // closed after all the dups and redirections.
+    std::vector<int> owned_fds; // opened by smash for this child only (here documents). closed once it is launched.
+    int process_group = 0; // process group for the child, 0 puts it in a new group of its own.
+    Placement placement; // posix_spawn cannot apply it or the limits, so a child with either is always forked.
+    Limits limits;
+};
+
+class Launcher {
+public:
+    Launcher();
+
+    LaunchBackend backend;
+
+    int launch(const LaunchSpec &spec);
+
+    static const char *backendName(LaunchBackend backend);
+
+    // applies redirections to the fds of the calling process, a child which is about to exec or run a builtin.
+    static bool applyFdActions(const std::vector<FdAction> &actions);
+
+private:
+    int launchFork(const LaunchSpec &spec, std::vector<char *> &argv);
+
+    int launchSpawn(const LaunchSpec &spec, std::vector<char *> &argv);
+};
+
 class ExternalCommand : public Command {
 public:
     explicit ExternalCommand(string &cmd_line) : Command(cmd_line) {};
 
     virtual ~ExternalCommand() = default;
 
+    // false when the command's redirections could not be set up.
+    bool prepareLaunch(LaunchSpec &spec);
+
     void execute() override;
 };
 
+// a pipeline of any number of stages, separated by | (stdout) or |& (stderr). the stages are in the parsed line. with
+// a trailing & it runs in the background, as one job.
 class PipeCommand : public Command {
 public:
-    explicit PipeCommand(string &cmd_line, bool first, bool second) : Command(cmd_line), first_pipe(first),
-                                                                      second_pipe(second) {};
-    bool first_pipe;
-    bool second_pipe;
+    explicit PipeCommand(string &cmd_line) : Command(cmd_line) {};
 
     virtual ~PipeCommand() = default;
 
+    void execute() override;
+
+private:
+    int launchStage(unsigned int stage, const std::vector<std::pair<int, int>> &dup_fds,
+                    const std::vector<int> &close_fds, int process_group);
+};
+
+class PipeFailCommand : public BuiltInCommand {
+public:
+    explicit PipeFailCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~PipeFailCommand() = default;
+
     void execute() override;
 };
 
-class RedirectionCommand : public Command {
+class PipeStatusCommand : public BuiltInCommand {
 public:
-    explicit RedirectionCommand(string &cmd_line, bool first, bool second) : Command(cmd_line),
-                                                                             first_redirection(first),
-                                                                             second_redirection(second) {};
-    bool first_redirection;
-    bool second_redirection;
+    explicit PipeStatusCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
 
-    virtual ~RedirectionCommand() = default;
+    virtual ~PipeStatusCommand() = default;
 
     void execute() override;
 };
@@ -127,33 +331,74 @@ public:
     void execute() override;
 };
 
+// the last bytes a background job wrote, read from a pipe the event loop drains. older output is overwritten, so the
+// memory stays the same however much the job writes.
+class OutputRing {
+public:
+    explicit OutputRing(size_t capacity, int fd) : buffer(capacity), start(0), size(0), total(0), fd(fd) {};
+
+    std::vector<char> buffer;
+    size_t start; // the oldest byte kept.
+    size_t size;
+    unsigned long long total; // every byte the job wrote, kept or not.
+    int fd; // read end of the job's pipe, -1 once the job closed it.
+
+    // reads everything the pipe has now. returns false when the job closed its end.
+    bool drain();
+
+    // closes the pipe, after reading what is left in it.
+    void close();
+
+    // the kept output, or only its last lines when lines is not 0.
+    string tail(unsigned int lines) const;
+
+private:
+    void append(const char *data, size_t length);
+};
+
 class JobEntry {
 public:
     JobEntry(int job_id, int process_id, string &job_command, time_t start_time, bool stopped, bool finished) :
             job_id(job_id), process_id(process_id), job_command(job_command), start_time(start_time),
-            is_stopped(stopped), is_finished(finished) {};
+            is_stopped(stopped), is_finished(finished), pidfd(-1), output(nullptr) {};
     int job_id;
     int process_id;
     string job_command;
     time_t start_time;
     bool is_stopped;
     bool is_finished;
+    int pidfd; // refers to this very process, so a signal can never hit another process that reused the pid.
+    Placement placement; // as given to run, or changed since by sched.
+    Limits limits;
+    OutputRing *output; // stdout and stderr of the job when capture is on, owned by the job.
 
     int calc_job_elapsed_time() const;
 
+    // same as kill(process_id, signum), through the pidfd when there is one, then the same for the rest of the process
+    // group the job leads (the other stages of a pipeline).
+    int sendSignal(int signum) const;
+
     void continue_job();
 };
 
+// jobs are indexed by job id (ordered, for listing and max id), by pid, and the stopped ones by job id too.
 class JobsList {
 public:
-    std::vector<JobEntry> job_list;
+    std::map<int, JobEntry> job_list;
+    std::unordered_map<int, int> pid_to_job_id;
+    std::set<int> stopped_job_ids;
+    std::vector<string> limit_kills; // jobs which died on one of their limits since jobs last ran, as jobs prints them.
+    std::list<std::pair<int, OutputRing *>> finished_outputs; // job id -> output of the last jobs removed, oldest first.
+
+    ~JobsList();
+
+    // the captured output of a job, running or recently finished. nullptr when there is none.
+    OutputRing *getOutput(int jobId);
 
     void addJob(Command *cmd, int process_id, bool is_stopped);
 
     JobEntry *getMaxJob();
 
-    void removeFinishedJobs();
-
     JobEntry *getLastStoppedJob();
 
     JobEntry *getJobById(int jobId);
@@ -164,6 +409,9 @@ public:
 
     void removeJobByPId(int jobPId);
 
+    // is_stopped must only be changed here, so the stopped index stays in sync.
+    void setStopped(JobEntry *job, bool is_stopped);
+
     void update_max_id();
 };
 
@@ -217,20 +465,250 @@ public:
     void execute() override;
 };
 
+// capture [on [SIZE] | off] - sends the stdout and stderr of every background job from now on to a ring of SIZE
+// bytes, instead of the terminal.
+class CaptureCommand : public BuiltInCommand {
+public:
+    explicit CaptureCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~CaptureCommand() = default;
+
+    void execute() override;
+};
+
+// joblog <job-id> [--tail N] - prints the captured output of a job.
+class JobLogCommand : public BuiltInCommand {
+public:
+    JobLogCommand(string &cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs_list(jobs) {};
+    JobsList *jobs_list;
+
+    virtual ~JobLogCommand() = default;
+
+    void execute() override;
+};
+
+// history [-v] [N | -p PREFIX | -s TEXT] - the last N entries, or the entries starting with PREFIX or containing
+// TEXT. -v adds when each one ran, for how long, its exit status and its working directory.
+class HistoryCommand : public BuiltInCommand {
+public:
+    explicit HistoryCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~HistoryCommand() = default;
+
+    void execute() override;
+
+    static void printEntry(const HistoryEntry &entry, bool verbose);
+};
+
+enum CopyMethod {
+    COPY_FILE_RANGE, COPY_SPLICE, COPY_SENDFILE, COPY_BUFFERED
+};
+
 class CatCommand : public BuiltInCommand {
 public:
     explicit CatCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
 
     virtual ~CatCommand() = default;
 
+    // copies in_fd to out_fd until EOF with the fastest way the kernel offers for these fds. returns -1 on failure.
+    static ssize_t copyFd(int in_fd, int out_fd, size_t buffer_size, CopyMethod &method);
+
+    static const char *methodName(CopyMethod method);
+
     void execute() override;
+
+private:
+    static ssize_t copyZero(int in_fd, int out_fd, CopyMethod method, bool &unsupported);
+
+    static ssize_t copyBuffered(int in_fd, int out_fd, size_t buffer_size);
+};
+
+// the text filters read files, or stdin without any, through LineBlockReader and write to cout. in a pipeline they
+// run in a forked smash like any builtin, so no stage execs a program. they are programs too, and a line which needs
+// bash (a glob, a variable...) runs the program instead.
+class TextFilterCommand : public BuiltInCommand {
+public:
+    explicit TextFilterCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~TextFilterCommand() = default;
+};
+
+// grep [-vcniF] PATTERN [FILE...]. the status is 0 when a line was selected, 1 when none was and 2 on errors.
+class GrepCommand : public TextFilterCommand {
+public:
+    explicit GrepCommand(string &cmd_line) : TextFilterCommand(cmd_line), invert(false), count_only(false),
+                                             line_numbers(false) {};
+
+    virtual ~GrepCommand() = default;
+
+    void execute() override;
+
+private:
+    bool invert;
+    bool count_only;
+    bool line_numbers;
+    string prefix; // "file:" when there are several files.
+    long line_number; // of the line at counted_to.
+    const char *counted_to;
+
+    // the selected lines of fd go to cout. returns how many there were.
+    long search(int fd, const GrepPattern &pattern);
+
+    // the next matching line in [pos, end), as [line_begin, line_end) with its newline. false when there is none.
+    static bool nextMatch(const GrepPattern &pattern, const char *pos, const char *end, const char *&line_begin,
+                          const char *&line_end);
+
+    // prints the whole lines [begin, end).
+    void printLines(const char *begin, const char *end);
+};
+
+// wc [-lwc] [FILE...]. without options all three are counted.
+class WcCommand : public TextFilterCommand {
+public:
+    explicit WcCommand(string &cmd_line) : TextFilterCommand(cmd_line) {};
+
+    virtual ~WcCommand() = default;
+
+    void execute() override;
+};
+
+// head [-n N | -N] [FILE...]. stops reading once it has the lines, so the command writing to it gets SIGPIPE.
+class HeadCommand : public TextFilterCommand {
+public:
+    explicit HeadCommand(string &cmd_line) : TextFilterCommand(cmd_line) {};
+
+    virtual ~HeadCommand() = default;
+
+    void execute() override;
+};
+
+// tail [-n N | -N] [-f] [FILE]. a file is read backwards from its end. -f then waits for inotify to report more, in a
+// forked smash which is the foreground process, so ctrl-C and ctrl-Z reach it like any external command.
+class TailCommand : public TextFilterCommand {
+public:
+    explicit TailCommand(string &cmd_line) : TextFilterCommand(cmd_line) {};
+
+    virtual ~TailCommand() = default;
+
+    void execute() override;
+
+    // where the last n lines of data[0, length) start.
+    static size_t lastLinesStart(const char *data, size_t length, long n);
+
+private:
+    // the offset where the last n lines of a regular file start.
+    static off_t fileLinesStart(int fd, off_t size, long n);
+
+    // prints what is appended to the file from the current offset on, until killed.
+    void follow(int fd, const string &path);
 };
 
+// sort [-nruv] [-t C] [-k F1[,F2]] [-S SIZE] [-P N] [FILE...]. input bigger than the memory limit (-S, with K, M or G)
+// is sorted in runs spilled to temporary files and merged at the end, see ExternalSorter. each run is sorted by up to
+// -P threads, one per cpu by default. -v reports the lines, the runs spilled and the memory used to stderr.
+class SortCommand : public TextFilterCommand {
+public:
+    explicit SortCommand(string &cmd_line) : TextFilterCommand(cmd_line) {};
+
+    virtual ~SortCommand() = default;
+
+    void execute() override;
+
+private:
+    // -k F1[,F2]. n or r after a field are for the key only, and own_options says whether there were any. returns
+    // false when it is not valid.
+    static bool parseKey(const string &key, SortKeys &keys, bool &own_options);
+};
+
+class LauncherCommand : public BuiltInCommand {
+public:
+    explicit LauncherCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~LauncherCommand() = default;
+
+    void execute() override;
+};
+
+class HashCommand : public BuiltInCommand {
+public:
+    explicit HashCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~HashCommand() = default;
+
+    void execute() override;
+};
+
+// runs the lines of a file or of stdin as commands, keeping up to a given number of them running at once. given a
+// command, every line adds its words to the command (or replaces {} in it) instead.
+class ParallelCommand : public BuiltInCommand {
+public:
+    explicit ParallelCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~ParallelCommand() = default;
+
+    void execute() override;
+
+    static unsigned int cpuCount();
+
+    // an unnamed temporary file, for the output of a job or a run of sort.
+    static int openCaptureFile();
+
+private:
+    class ParallelJob {
+    public:
+        string command;
+        int pid = -1;
+        int output_fd = -1; // with -k, the job's stdout, kept until every job before it was printed.
+        long long start_time = 0;
+        long long end_time = 0;
+        bool done = false;
+        int status = 0;
+    };
+
+    ParsedLine job_line; // reused for every job.
+
+    // returns the number of failed jobs.
+    int runJobs(InputReader &input, const string &command_template, unsigned int slots, bool keep_order, bool verbose);
+
+    int launchJob(ParallelJob &job, bool keep_order);
+
+    // prints the output of a done job, with -v its exit status and run time too.
+    static void printJob(unsigned int seq, ParallelJob &job, bool verbose);
+};
+
+// remembers where every external command was found on $PATH, so launching it again does not walk the PATH.
+class PathCache {
+public:
+    class PathEntry {
+    public:
+        PathEntry(const string &path) : path(path), hits(0) {};
+        string path;
+        int hits;
+    };
+
+    std::unordered_map<string, PathEntry> entries;
+    string cached_path_env; // value of $PATH the entries were resolved against.
+
+    bool resolve(const string &command, string &full_path);
+
+    bool insert(const string &command);
+
+    void remove(const string &command);
+
+    void flush();
+
+private:
+    bool searchPath(const string &command, string &full_path) const;
+};
+
+// pending timeouts, kept in a binary min-heap by deadline. a timerfd on CLOCK_MONOTONIC becomes readable when the
+// earliest deadline is due, so timeouts have sub-millisecond precision and do not drift with the wall clock.
 class TimeOutList {
 public:
     class TimeOutEntry {
     public:
-        TimeOutEntry(const string &cmd_line, const string &un_proccessed_cmd, int pid, int duration, time_t start_time, bool is_timeout_bg)
+        TimeOutEntry(const string &cmd_line, const string &un_proccessed_cmd, int pid, long long duration,
+                     long long start_time, bool is_timeout_bg)
                 : cmd_line(cmd_line), un_proccessed_cmd(un_proccessed_cmd), pid(pid), start_time(start_time),
                   duration(duration), is_timeout_bg(is_timeout_bg) {
             kill_time = duration + start_time;
@@ -239,49 +717,97 @@ public:
         string cmd_line;
         string un_proccessed_cmd;
         int pid = -1;
-        time_t kill_time; // time when the alarm should go off.
-        time_t start_time; // time when we wrote the command.
-        time_t duration; // how long the actual timeout is (timeout _duration_ ...)
+        long long kill_time; // time when the alarm should go off, in monotonic nanoseconds.
+        long long start_time; // time when we wrote the command, in monotonic nanoseconds.
+        long long duration; // how long the actual timeout is (timeout _duration_ ...), in nanoseconds.
         bool is_timeout_bg;
         ~TimeOutEntry() = default;
     };
 
-    time_t cur_minimum_time;
-    std::vector<TimeOutEntry> timeout_list;
+    TimeOutList() : timer_fd(-1) {};
 
-    static bool timeComparor(const TimeOutEntry &first, const TimeOutEntry &second) {
-        return (first.kill_time < second.kill_time);
-    }
+    std::vector<TimeOutEntry> timeout_list; // the heap - timeout_list[0] has the earliest deadline.
+    std::unordered_map<int, unsigned int> pid_to_index;
 
-    void
-    add_entry(const string &cmd_line, const string &un_proccessed_cmd, int pid, time_t duration, time_t start_time, bool is_timeout_bg) {
-        TimeOutEntry time_out_entry(cmd_line, un_proccessed_cmd, pid, duration, start_time, is_timeout_bg);
-        timeout_list.push_back(time_out_entry);
-        std::sort(timeout_list.begin(), timeout_list.end(), timeComparor);
-        alarm(difftime(timeout_list.begin()->kill_time, time(nullptr)));
-    }
+    static long long now();
 
-    void remove_entry(int pid) {
-        unsigned int pos;
-        if (timeout_list.empty())
-            return;
-        for (pos = 0; pos < timeout_list.size(); pos++) {
-            if (timeout_list[pos].pid == pid) break;
-        }
-        timeout_list.erase(timeout_list.begin() + pos);
-        if(timeout_list.empty())
-            return;
-        std::sort(timeout_list.begin(), timeout_list.end(), timeComparor);
-        alarm(difftime(timeout_list.begin()->kill_time, time(nullptr)));
-    }
+    // the fd the event loop watches, created on first use.
+    int timerFd();
 
-    TimeOutEntry *getTimeOutByPid(int pid) {
-        for (auto &timeout : timeout_list) {
-            if (timeout.pid == pid)
-                return &timeout;
-        }
-        return nullptr;
-    }
+    // drops every entry and the timer, for a forked smash which must not touch its parent's timeouts.
+    void reset();
+
+    void add_entry(const string &cmd_line, const string &un_proccessed_cmd, int pid, long long duration,
+                   bool is_timeout_bg);
+
+    // cancels the timeout of pid.
+    void remove_entry(int pid);
+
+    // moves the deadline of pid by delta nanoseconds (negative to shorten it).
+    void extend_entry(int pid, long long delta);
+
+    TimeOutEntry *getTimeOutByPid(int pid);
+
+    TimeOutEntry *top();
+
+    void pop();
+
+private:
+    int timer_fd;
+
+    void swapEntries(unsigned int first, unsigned int second);
+
+    void siftUp(unsigned int pos);
+
+    void siftDown(unsigned int pos);
+
+    void removeAt(unsigned int pos);
+
+    void rearm();
+};
+
+// what a process of a timed line used, as the kernel reported it when the process was reaped.
+class ProcessUsage {
+public:
+    string command;
+    int pid;
+    int status;
+    struct rusage usage;
+};
+
+// runs the rest of the line (a pipeline, a redirection, a builtin...) and reports on stderr the wall time, and the cpu
+// time, max RSS, context switches and page faults of every process it ran and of smash itself.
+class TimeCommand : public BuiltInCommand {
+public:
+    explicit TimeCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~TimeCommand() = default;
+
+    void execute() override;
+};
+
+// run [--cpus LIST] [--nice N] [--io CLASS[:LEVEL]] [--sched POLICY] [--as SIZE] [--cpu-time SECS] [--nofile N]
+// [--fsize SIZE] command - launches the command with the given cpu affinity, nice value, io priority, scheduling policy
+// and resource limits. when one of them can not be applied the command is not run at all.
+class RunCommand : public BuiltInCommand {
+public:
+    explicit RunCommand(string &cmd_line) : BuiltInCommand(cmd_line) {};
+
+    virtual ~RunCommand() = default;
+
+    void execute() override;
+};
+
+// sched <job-id> [options of run] - changes the placement and limits of a running job, or shows them without options.
+// when a change fails the job is left as it was.
+class SchedCommand : public BuiltInCommand {
+public:
+    SchedCommand(string &cmd_line, JobsList *jobs) : BuiltInCommand(cmd_line), jobs_list(jobs) {};
+    JobsList *jobs_list;
+
+    virtual ~SchedCommand() = default;
+
+    void execute() override;
 };
 
 class TimeOutCommand : public Command {
@@ -293,12 +819,144 @@ public:
     void execute() override;
 };
 
+// every command smash runs itself: the first word, the class, and the arguments of its constructor.
+// CreateSimpleCommand switches on the hash of the first word, so two names with the same hash do not compile.
+#define SMASH_BUILTINS(X)                                          \
+    X("pwd", GetCurrDirCommand, (cmd_line))                        \
+    X("showpid", ShowPidCommand, (cmd_line))                       \
+    X("jobs", JobsCommand, (cmd_line, &jobs))                      \
+    X("chprompt", ChangePromptCommand, (cmd_line))                 \
+    X("cd", ChangeDirCommand, (cmd_line))                          \
+    X("kill", KillCommand, (cmd_line, &jobs))                      \
+    X("fg", ForegroundCommand, (cmd_line, &jobs))                  \
+    X("bg", BackgroundCommand, (cmd_line, &jobs))                  \
+    X("quit", QuitCommand, (cmd_line, &jobs))                      \
+    X("cat", CatCommand, (cmd_line))                               \
+    X("hash", HashCommand, (cmd_line))                             \
+    X("launcher", LauncherCommand, (cmd_line))                     \
+    X("pipefail", PipeFailCommand, (cmd_line))                     \
+    X("pipestatus", PipeStatusCommand, (cmd_line))                 \
+    X("parallel", ParallelCommand, (cmd_line))                     \
+    X("timeout", TimeOutCommand, (cmd_line))                       \
+    X("time", TimeCommand, (cmd_line))                             \
+    X("run", RunCommand, (cmd_line))                               \
+    X("sched", SchedCommand, (cmd_line, &jobs))                    \
+    X("capture", CaptureCommand, (cmd_line))                       \
+    X("joblog", JobLogCommand, (cmd_line, &jobs))                  \
+    X("history", HistoryCommand, (cmd_line))                       \
+    X("grep", GrepCommand, (cmd_line))                             \
+    X("wc", WcCommand, (cmd_line))                                 \
+    X("head", HeadCommand, (cmd_line))                             \
+    X("tail", TailCommand, (cmd_line))                             \
+    X("sort", SortCommand, (cmd_line))
+
+// FNV-1a, usable as a case label.
+constexpr uint32_t commandHash(const char *word, uint32_t hash = 2166136261u) {
+    return *word == '\0' ? hash : commandHash(word + 1, (hash ^ (unsigned char) *word) * 16777619u);
+}
+
+// an output buffer which writes to an fd. smash's cout goes through one, so a builtin printing many lines makes a
+// few big writes instead of one per std::endl, and so do the cout and cerr of a builtin with redirections. on a
+// terminal it is line buffered, so output still shows up a line at a time.
+class FdStreamBuf : public std::streambuf {
+public:
+    FdStreamBuf() : fd(-1), line_buffered(false) {};
+
+    void open(int new_fd, bool flush_lines = false) {
+        fd = new_fd;
+        line_buffered = flush_lines;
+        buffer.resize(FD_STREAM_BUFFER_SIZE);
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+
+protected:
+    int overflow(int c) override;
+
+    std::streamsize xsputn(const char *data, std::streamsize length) override;
+
+    int sync() override;
+
+private:
+    int fd;
+    bool line_buffered;
+    std::vector<char> buffer;
+
+    // writes the buffered bytes and then length more bytes of data, in as few writev calls as it takes.
+    bool writeOut(const char *data, size_t length);
+};
+
+// the redirections of a builtin, which runs inside smash. smash opens the files and the builtin gets them as
+// SmallShell::std_fds, cout and cerr, so smash's own 0, 1 and 2 are never touched. the pipes of its substitutions do
+// go on the fds their words name, which smash does not use otherwise. the destructor undoes it all.
+class BuiltinRedirection {
+public:
+    BuiltinRedirection() : saved_out(nullptr), saved_err(nullptr) {};
+
+    ~BuiltinRedirection();
+
+    // false when a file could not be opened, and then the builtin does not run.
+    bool apply(Command &cmd);
+
+private:
+    int saved_fds[3];
+    std::vector<std::pair<int, int>> substitution_fds; // (fd of a substitution, copy of what it was before or -1).
+    std::vector<int> opened_fds;
+    FdStreamBuf out_buf;
+    FdStreamBuf err_buf;
+    std::streambuf *saved_out;
+    std::streambuf *saved_err;
+};
+
+// the commands of a line live here instead of on the heap. they are destroyed together when the line is done,
+// and the memory is reused by the next line.
+class CommandArena {
+public:
+    class Mark {
+    public:
+        size_t block;
+        size_t offset;
+        size_t num_of_commands;
+    };
+
+    CommandArena() : curr_block(0), curr_offset(0) {};
+
+    ~CommandArena();
+
+    CommandArena(CommandArena const &) = delete;
+    void operator=(CommandArena const &) = delete;
+
+    template<class T, class... Args>
+    T *create(Args &&... args) {
+        // allocate never hands out more than one block.
+        static_assert(sizeof(T) <= ARENA_BLOCK_SIZE, "a command must fit in one arena block");
+        T *cmd = new(allocate(sizeof(T))) T(std::forward<Args>(args)...);
+        commands.push_back(cmd);
+        return cmd;
+    }
+
+    Mark mark() const {
+        return Mark {curr_block, curr_offset, commands.size()};
+    }
+
+    // destroys every command created after the mark, newest first.
+    void release(const Mark &mark);
+
+private:
+    std::vector<char *> blocks;
+    size_t curr_block;
+    size_t curr_offset;
+    std::vector<Command *> commands;
+
+    void *allocate(size_t size);
+};
+
 class SmallShell {
 public:
     SmallShell() : prompt("smash> "), prev_wd(""), current_fg_pid(-1), current_fg_job_id(-1), max_job_id(-1),
-                   curr_fg_command(nullptr) {} ;
+                   curr_fg_command(nullptr), last_status(0), errors_printed(0), pipefail(false), std_fds{STDIN_FILENO, STDOUT_FILENO,
+                   STDERR_FILENO}, capture_size(0), time_log(nullptr), parse_depth(0), saved_cout_buf(nullptr) {} ;
 
-    ~SmallShell() = default;
+    ~SmallShell();
 
     string prompt;
     string prev_wd;
@@ -306,10 +964,38 @@ public:
     int current_fg_job_id;
     int max_job_id;
     Command *curr_fg_command;
+    int last_status; // exit status of the last foreground command.
+    unsigned long errors_printed; // by smashPerror.
+    std::vector<int> pipe_statuses; // exit status of every stage of the last pipeline.
+    bool pipefail; // a pipeline fails if any of its stages failed, not only the last one.
+    int std_fds[3]; // stdin, stdout and stderr of builtins, and of what they launch. 0, 1, 2 unless redirected.
+    size_t capture_size; // size of the output ring of every new background job, 0 when capture is off.
+    std::vector<ProcessUsage> *time_log; // while time runs, every foreground process that finishes is recorded here.
     JobsList jobs;
     TimeOutList time_out_list;
+    PathCache path_cache;
+    Launcher launcher;
+    EventLoop event_loop;
+    History history;
+
+    std::vector<ParsedLine *> parsed_lines; // one per nesting level of executeCommand, reused from line to line.
+    unsigned int parse_depth;
+    CommandArena command_arena; // owns every command, they are not deleted one by one.
+    FdStreamBuf stdout_buf; // cout writes through it once bufferOutput was called.
+    std::streambuf *saved_cout_buf;
+
+    // sends cout through stdout_buf. whatever is buffered is written before smash launches a process, before it
+    // blocks and after every line, so output stays in order with children and with perror.
+    void bufferOutput();
 
-    Command *CreateCommand(string &cmd_line);
+    // records a finished foreground process for time, when it runs.
+    void logUsage(const string &command, int pid, int status, const struct rusage &usage);
+
+    // the command for a whole parsed line - time, a pipeline or a simple command.
+    Command *CreateCommand(ParsedLine &parsed);
+
+    // the command made of tokens [first_token, end_token) of a parsed line. it applies the redirections of stage.
+    Command *CreateSimpleCommand(ParsedLine &parsed, unsigned int first_token, unsigned int end_token, int stage = -1);
 
     SmallShell(SmallShell const &) = delete; // disable copy ctor
     void operator=(SmallShell const &) = delete; // disable = operator
@@ -321,7 +1007,25 @@ public:
         return instance;
     }
 
-    void executeCommand(string &cmd_line);
+    void executeCommand(const char *cmd_line, size_t length);
+
+    void executeCommand(const string &cmd_line) {
+        executeCommand(cmd_line.data(), cmd_line.size());
+    }
+
+    // a line from the input. while history is recorded, !n and !prefix are expanded and the line is recorded.
+    void executeInputLine(const char *cmd_line, size_t length);
+
+    // reads the bodies of the here documents of line from the input and appends them to it, each after a newline.
+    void readHereBodies(string &line);
+
+    // starts the command of a substitution, with fd as its stdin or stdout (target). a simple external command is
+    // launched directly and the fds smash holds are close-on-exec. anything else runs in a forked smash, which does not
+    // exec, so it closes close_fds first.
+    int launchSubstitution(const string &command, int fd, int target, const std::vector<int> &close_fds);
+
+    // replaces a leading !!, !n, !-n or !prefix with the command it refers to. false if there is no such entry.
+    bool expandHistory(string &line);
 };
 
 #endif //SMASH_COMMAND_H_
\ No newline at end of file
@@ -0,0 +1,332 @@
+#include <iostream>
+#include <unistd.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include "event_loop.h"
+#include "signals.h"
+#include "Commands.h"
+
+using namespace std;
+
+sigset_t EventLoop::handledSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTSTP);
+    sigaddset(&signals, SIGALRM);
+    sigaddset(&signals, SIGCHLD);
+    return signals;
+}
+
+bool EventLoop::registerFd(int fd) {
+    struct epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+bool EventLoop::setupFds() {
+    sigset_t signals = handledSignals();
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        smashPerror("smash error: epoll_create1 failed");
+        return false;
+    }
+    if ((signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        smashPerror("smash error: signalfd failed");
+        return false;
+    }
+    timer_fd = SmallShell::getInstance().time_out_list.timerFd();
+    if (!registerFd(signal_fd) || (timer_fd != -1 && !registerFd(timer_fd))) {
+        smashPerror("smash error: epoll_ctl failed");
+        return false;
+    }
+    return true;
+}
+
+void EventLoop::closeFds() {
+    if (epoll_fd != -1)
+        close(epoll_fd);
+    if (signal_fd != -1)
+        close(signal_fd);
+    epoll_fd = signal_fd = timer_fd = -1;
+    stdin_registered = false;
+}
+
+bool EventLoop::init(int fd) {
+    sigset_t signals = handledSignals();
+    if (sigprocmask(SIG_BLOCK, &signals, nullptr) == -1) {
+        smashPerror("smash error: sigprocmask failed");
+        return false;
+    }
+    input.open(fd);
+    interactive = input.lineMode();
+    return setupFds();
+}
+
+void EventLoop::reinitAfterFork() {
+    closeFds();
+    foreground_statuses.clear();
+    foreground_usages.clear();
+    output_fds.clear();
+    SmallShell::getInstance().time_out_list.reset();
+    setupFds();
+}
+
+void EventLoop::handleEvents(int timeout) {
+    struct epoll_event events[MAX_EVENTS];
+    // nothing smash printed waits in its buffer while smash waits.
+    if (timeout != 0)
+        cout.flush();
+    int num_of_events = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+    if (num_of_events == -1) {
+        if (errno != EINTR)
+            smashPerror("smash error: epoll_wait failed");
+        return;
+    }
+    for (int i = 0; i < num_of_events; i++) {
+        int fd = events[i].data.fd;
+        if (fd == signal_fd)
+            handleSignals();
+        else if (fd == timer_fd)
+            handleTimer();
+        else if (fd == input.inputFd())
+            input.fill();
+        else if (output_fds.count(fd) != 0)
+            handleOutput(fd);
+    }
+}
+
+void EventLoop::handleSignals() {
+    struct signalfd_siginfo info {};
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        switch (info.ssi_signo) {
+            case SIGINT:
+                ctrlCHandler(SIGINT);
+                break;
+            case SIGTSTP:
+                ctrlZHandler(SIGTSTP);
+                break;
+            case SIGALRM:
+                alarmHandler(SIGALRM);
+                break;
+            case SIGCHLD:
+                reapChildren();
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void EventLoop::handleTimer() {
+    uint64_t expirations;
+    if (read(timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+        smashPerror("smash error: read failed");
+    alarmHandler(SIGALRM);
+}
+
+// builds the status waitpid would have returned for this child.
+static int statusOf(const siginfo_t &info) {
+    switch (info.si_code) {
+        case CLD_EXITED:
+            return (info.si_status & 0xff) << 8;
+        case CLD_KILLED:
+            return info.si_status & 0x7f;
+        case CLD_DUMPED:
+            return (info.si_status & 0x7f) | 0x80;
+        case CLD_STOPPED:
+        case CLD_TRAPPED:
+            return ((info.si_status & 0xff) << 8) | 0x7f;
+        default:
+            return 0xffff; // continued
+    }
+}
+
+void EventLoop::reapChildren() {
+    SmallShell &smash = SmallShell::getInstance();
+    bool printed_notice = false;
+    siginfo_t info;
+    struct rusage usage {};
+    while (true) {
+        // waitid leaves si_pid zero when no child has changed state. the syscall itself also returns the rusage of the
+        // child, which the glibc wrapper drops.
+        info.si_pid = 0;
+        if (syscall(SYS_waitid, P_ALL, 0, &info, WEXITED | WSTOPPED | WCONTINUED | WNOHANG, &usage) == -1 ||
+            info.si_pid == 0)
+            break;
+        int pid = info.si_pid;
+        bool finished = (info.si_code == CLD_EXITED || info.si_code == CLD_KILLED || info.si_code == CLD_DUMPED);
+        auto foreground = foreground_statuses.find(pid);
+        if (foreground != foreground_statuses.end()) {
+            // the foreground waits for its children to finish or stop.
+            if (info.si_code != CLD_CONTINUED) {
+                foreground->second = statusOf(info);
+                foreground_usages[pid] = usage;
+            }
+            continue;
+        }
+        JobEntry *job = smash.jobs.getJobByPId(pid);
+        if (!finished) {
+            // stopped or continued by a signal from anywhere, smash's kill included.
+            if (job != nullptr)
+                smash.jobs.setStopped(job, info.si_code != CLD_CONTINUED);
+            continue;
+        }
+        if (job != nullptr) {
+            // a job killed by one of its limits says which, here and in the next jobs. a job with limits which failed
+            // otherwise only shows its exit status, as it may have hit one of them or not.
+            string violation = job->limits.violation(statusOf(info));
+            if (!violation.empty())
+                smash.jobs.limit_kills.push_back("[" + to_string(job->job_id) + "]" + job->job_command + " : " +
+                                                 to_string(pid) + " " + violation);
+            else if (job->limits.isSet() && exitCodeOf(statusOf(info)) != 0)
+                violation = "exit status " + to_string(exitCodeOf(statusOf(info)));
+            if (interactive) {
+                cout << (at_prompt && !printed_notice ? "\n" : "") << "smash: [" << job->job_id << "]"
+                     << job->job_command << " : " << pid << " done"
+                     << (violation.empty() ? "" : " (" + violation + ")") << '\n';
+                printed_notice = true;
+            }
+            smash.jobs.removeJobById(job->job_id);
+        }
+        smash.time_out_list.remove_entry(pid);
+    }
+    smash.jobs.update_max_id();
+    if (printed_notice && at_prompt)
+        cout << smash.prompt << flush;
+}
+
+void EventLoop::watchOutput(int fd, int pid) {
+    if (registerFd(fd))
+        output_fds[fd] = pid;
+    else
+        smashPerror("smash error: epoll_ctl failed");
+}
+
+void EventLoop::unwatchOutput(int fd) {
+    if (output_fds.erase(fd) != 0)
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void EventLoop::handleOutput(int fd) {
+    JobEntry *job = SmallShell::getInstance().jobs.getJobByPId(output_fds[fd]);
+    if (job == nullptr || job->output == nullptr) {
+        unwatchOutput(fd);
+        return;
+    }
+    // the job closed its end, which is all the ring gets from it.
+    if (!job->output->drain()) {
+        unwatchOutput(fd);
+        job->output->close();
+    }
+}
+
+void EventLoop::watchInput(bool watch) {
+    if (!stdin_registered)
+        return;
+    struct epoll_event event {};
+    event.events = watch ? EPOLLIN : 0;
+    event.data.fd = input.inputFd();
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, input.inputFd(), &event);
+}
+
+void EventLoop::watchForeground(const vector<int> &pids, bool watch) {
+    for (int pid : pids) {
+        if (watch) {
+            foreground_statuses.insert({pid, -1});
+        } else {
+            foreground_statuses.erase(pid);
+            foreground_usages.erase(pid);
+        }
+    }
+}
+
+void EventLoop::waitForeground(const vector<int> &pids, vector<int> &statuses, vector<struct rusage> *usages) {
+    // a watched pid may have finished already.
+    watchForeground(pids, true);
+    // the input belongs to the foreground until it is done.
+    watchInput(false);
+    // a SIGCHLD of these pids may be pending already, so the children are checked once before blocking.
+    reapChildren();
+    while (true) {
+        unsigned int pending = 0;
+        for (int pid : pids)
+            pending += (foreground_statuses[pid] == -1);
+        if (pending == 0)
+            break;
+        handleEvents(-1);
+    }
+    watchInput(true);
+    statuses.clear();
+    if (usages != nullptr)
+        usages->clear();
+    for (int pid : pids) {
+        statuses.push_back(foreground_statuses[pid]);
+        foreground_statuses.erase(pid);
+        if (usages != nullptr)
+            usages->push_back(foreground_usages[pid]);
+        foreground_usages.erase(pid);
+    }
+}
+
+int EventLoop::waitForeground(int pid, struct rusage *usage) {
+    vector<int> statuses;
+    vector<struct rusage> usages;
+    waitForeground(vector<int>{pid}, statuses, &usages);
+    if (usage != nullptr)
+        *usage = usages[0];
+    return statuses[0];
+}
+
+unsigned int EventLoop::waitForegroundAny(const vector<int> &pids, int &status) {
+    // a pid which finished since the last call already has its status, and keeps it.
+    for (int pid : pids)
+        foreground_statuses.insert({pid, -1});
+    watchInput(false);
+    reapChildren();
+    while (true) {
+        for (unsigned int i = 0; i < pids.size(); i++) {
+            auto it = foreground_statuses.find(pids[i]);
+            if (it->second != -1) {
+                status = it->second;
+                foreground_statuses.erase(it);
+                foreground_usages.erase(pids[i]);
+                watchInput(true);
+                return i;
+            }
+        }
+        handleEvents(-1);
+    }
+}
+
+void EventLoop::feedInput(const string &commands) {
+    input.feed(commands);
+}
+
+bool EventLoop::readLine(LineView &line) {
+    if (!stdin_registered && stdin_pollable && !input.ended()) {
+        stdin_registered = registerFd(input.inputFd());
+        stdin_pollable = stdin_registered;
+    }
+    // events which are already pending are handled even when the next line is buffered, but a script of many short
+    // lines should not pay for a poll on every one of them.
+    if (!input.hasLine() || ++lines_since_poll == EVENT_POLL_LINES) {
+        handleEvents(0);
+        lines_since_poll = 0;
+    }
+    at_prompt = true;
+    while (!input.hasLine() && !input.ended()) {
+        if (stdin_pollable) {
+            handleEvents(-1);
+        } else {
+            // a regular file never blocks, so pending events are only polled for between reads.
+            handleEvents(0);
+            input.fill();
+        }
+    }
+    at_prompt = false;
+    return input.nextLine(line);
+}
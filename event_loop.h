@@ -0,0 +1,100 @@
+#ifndef SMASH_EVENT_LOOP_H_
+#define SMASH_EVENT_LOOP_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <signal.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "input_reader.h"
+
+#define EVENT_POLL_LINES 64 // while lines are buffered, pending events are only checked every this many lines.
+#define MAX_EVENTS 16
+
+// the only place smash blocks. stdin, a signalfd for the signals smash handles and the timeout timerfd are watched
+// with epoll, so the signal handlers run in normal context and never race with the code they would interrupt.
+class EventLoop {
+public:
+    EventLoop() : interactive(false), epoll_fd(-1), signal_fd(-1), timer_fd(-1), at_prompt(false),
+                  stdin_registered(false), stdin_pollable(true), lines_since_poll(0) {};
+
+    ~EventLoop() = default;
+
+    // blocks the handled signals and sets up the fds. has to run before any child is created.
+    // commands are read from input_fd, or only from what feedInput gave when it is -1.
+    bool init(int input_fd = STDIN_FILENO);
+
+    // queues commands to run before anything read from the input fd.
+    void feedInput(const std::string &commands);
+
+    // a forked smash must not share the epoll instance, the signalfd or the timer of its parent.
+    void reinitAfterFork();
+
+    // the signals smash takes through the signalfd, and so keeps blocked. children get them unblocked.
+    static sigset_t handledSignals();
+
+    // handles events until a full line was read. returns false when the input has ended.
+    // the line points into the input buffer and is valid until the next call.
+    bool readLine(LineView &line);
+
+    // handles events until every pid has exited or stopped, and returns their wait statuses. when usages is given, it
+    // gets what every pid used, as the kernel reported it when the pid was reaped.
+    void waitForeground(const std::vector<int> &pids, std::vector<int> &statuses,
+                        std::vector<struct rusage> *usages = nullptr);
+
+    int waitForeground(int pid, struct rusage *usage = nullptr);
+
+    // pids which are waited for later. what happens to them before that is kept, not taken for a background job.
+    // with watch false they are left to the background again.
+    void watchForeground(const std::vector<int> &pids, bool watch);
+
+    // handles events until one of pids (there must be at least one) has exited or stopped, and returns its index in
+    // pids with its wait status.
+    // the pids not returned stay watched, so they can be waited for again later without losing their status.
+    unsigned int waitForegroundAny(const std::vector<int> &pids, int &status);
+
+    // reaps every child which changed state. finished background jobs are removed from the jobs list.
+    void reapChildren();
+
+    // drains fd into the output ring of the job with this pid whenever the job writes to it.
+    void watchOutput(int fd, int pid);
+
+    void unwatchOutput(int fd);
+
+    bool interactive; // stdin is a terminal, so background completion notices are printed as they happen.
+
+private:
+    InputReader input;
+    int epoll_fd;
+    int signal_fd;
+    int timer_fd;
+    bool at_prompt;
+    bool stdin_registered;
+    bool stdin_pollable; // epoll refuses regular files, which are always readable anyway.
+    unsigned int lines_since_poll;
+    std::unordered_map<int, int> foreground_statuses; // pids the foreground waits for -> status, -1 while running.
+    std::unordered_map<int, struct rusage> foreground_usages; // the same pids -> rusage, once they exited or stopped.
+    std::unordered_map<int, int> output_fds; // output pipes of background jobs -> pid of the job.
+
+    bool setupFds();
+
+    void closeFds();
+
+    bool registerFd(int fd);
+
+    // stops or resumes watching the input, so a foreground command can read it without smash racing for it.
+    void watchInput(bool watch);
+
+    void handleEvents(int timeout);
+
+    void handleSignals();
+
+    void handleTimer();
+
+    void handleOutput(int fd);
+
+    void readInput();
+};
+
+#endif //SMASH_EVENT_LOOP_H_
@@ -0,0 +1,399 @@
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <new>
+#include <system_error>
+#include <thread>
+#include "external_sort.h"
+#include "Commands.h"
+
+using namespace std;
+
+// ***********************************************************************************************************************************
+// **********************************                KEYS                          ***************************************************
+// ***********************************************************************************************************************************
+
+static inline bool isBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// the number at the start of data[0, length), after blanks, the way sort -n reads it. 0 when there is none.
+static double parseNumber(const char *data, size_t length) {
+    size_t i = 0;
+    while (i < length && isBlank(data[i]))
+        i++;
+    bool negative = (i < length && data[i] == '-');
+    if (negative)
+        i++;
+    double number = 0;
+    for (; i < length && data[i] >= '0' && data[i] <= '9'; i++)
+        number = number * 10 + (data[i] - '0');
+    if (i < length && data[i] == '.') {
+        double scale = 0.1;
+        for (i++; i < length && data[i] >= '0' && data[i] <= '9'; i++, scale /= 10)
+            number += (data[i] - '0') * scale;
+    }
+    return negative ? -number : number;
+}
+
+static int compareBytes(const char *a, size_t a_length, const char *b, size_t b_length) {
+    int result = memcmp(a, b, min(a_length, b_length));
+    if (result != 0)
+        return result;
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+size_t SortKeys::fieldEnd(const char *data, size_t length, size_t pos) const {
+    if (separator != -1) {
+        const char *end = static_cast<const char *>(memchr(data + pos, separator, length - pos));
+        return end == nullptr ? length : end - data;
+    }
+    while (pos < length && isBlank(data[pos]))
+        pos++;
+    while (pos < length && !isBlank(data[pos]))
+        pos++;
+    return pos;
+}
+
+size_t SortKeys::fieldStart(const char *data, size_t length, unsigned int field) const {
+    size_t pos = 0;
+    for (unsigned int i = 1; i < field && pos < length; i++) {
+        pos = fieldEnd(data, length, pos);
+        // the separator belongs to neither field. blanks are the start of the next one.
+        if (separator != -1 && pos < length)
+            pos++;
+    }
+    return pos;
+}
+
+void SortKeys::fill(const char *text, SortLine &line) const {
+    const char *data = text + line.offset;
+    size_t begin = 0, end = line.length;
+    if (first_field != 0) {
+        begin = fieldStart(data, line.length, first_field);
+        if (last_field != 0)
+            end = max(begin, fieldEnd(data, line.length, fieldStart(data, line.length, last_field)));
+    }
+    line.key_begin = begin;
+    line.key_length = end - begin;
+    line.number = numeric ? parseNumber(data + begin, end - begin) : 0;
+}
+
+int SortKeys::compare(const char *a_text, const SortLine &a, const char *b_text, const SortLine &b) const {
+    const char *a_data = a_text + a.offset, *b_data = b_text + b.offset;
+    int result;
+    if (numeric)
+        result = (a.number > b.number) - (a.number < b.number);
+    else
+        result = compareBytes(a_data + a.key_begin, a.key_length, b_data + b.key_begin, b.key_length);
+    if (result != 0)
+        return reverse ? -result : result;
+    // the last resort, for keys which are not the whole line.
+    if (unique || (!numeric && first_field == 0))
+        return 0;
+    result = compareBytes(a_data, a.length, b_data, b.length);
+    return reverse_lines ? -result : result;
+}
+
+// ***********************************************************************************************************************************
+// **********************************                MERGING                       ***************************************************
+// ***********************************************************************************************************************************
+
+LoserTree::LoserTree(vector<SortSource *> &sources, const SortKeys &keys) : sources(sources), keys(keys),
+                                                                            tree(max((size_t) 1, sources.size()), 0) {
+    // the leaves are k..2k-1 of a heap numbered tree, and the matches are played from the bottom up.
+    int k = sources.size();
+    vector<int> winners(2 * k);
+    for (int i = 0; i < k; i++)
+        winners[k + i] = i;
+    for (int node = k - 1; node >= 1; node--) {
+        int a = winners[2 * node], b = winners[2 * node + 1];
+        winners[node] = beats(a, b) ? a : b;
+        tree[node] = beats(a, b) ? b : a;
+    }
+    if (k > 1)
+        tree[0] = winners[1];
+}
+
+bool LoserTree::beats(int a, int b) const {
+    // a source which is done loses to any other.
+    if (sources[a]->done || sources[b]->done)
+        return sources[b]->done && (!sources[a]->done || a < b);
+    int result = keys.compare(sources[a]->text, sources[a]->line, sources[b]->text, sources[b]->line);
+    return result < 0 || (result == 0 && a < b);
+}
+
+void LoserTree::advanceWinner() {
+    int k = sources.size();
+    int winner = tree[0];
+    sources[winner]->advance();
+    for (int node = (winner + k) / 2; node >= 1; node /= 2) {
+        if (beats(tree[node], winner))
+            swap(tree[node], winner);
+    }
+    tree[0] = winner;
+}
+
+// the lines [pos, end) of a run in memory, already sorted.
+class MemorySource : public SortSource {
+public:
+    MemorySource(const char *run_text, const SortLine *pos, const SortLine *end) : pos(pos), end(end) {
+        text = run_text;
+        advance();
+    };
+
+    void advance() override {
+        if (pos == end)
+            done = true;
+        else
+            line = *pos++;
+    }
+
+private:
+    const SortLine *pos;
+    const SortLine *end;
+};
+
+// a run read back from its file. every line of a run ends with a newline.
+class RunSource : public SortSource {
+public:
+    RunSource(int fd, const SortKeys &keys) : reader(fd), keys(keys), pos(0), end(0) {
+        advance();
+    };
+
+    void advance() override {
+        if (pos == end) {
+            if (!reader.next(text, end)) {
+                done = true;
+                return;
+            }
+            pos = 0;
+        }
+        const char *newline = static_cast<const char *>(memchr(text + pos, '\n', end - pos));
+        line.offset = pos;
+        line.length = newline - (text + pos);
+        keys.fill(text, line);
+        pos += line.length + 1;
+    }
+
+    LineBlockReader reader;
+
+private:
+    const SortKeys &keys;
+    size_t pos; // text[pos, end) is the rest of the block read last.
+    size_t end;
+};
+
+// where merged lines go: an ostream, or a run file through a buffer of its own.
+class SortSink {
+public:
+    SortSink(ostream *out, int fd) : written(0), out(out), fd(fd), failed(false) {};
+
+    void put(const char *data, size_t length) {
+        written += length + 1;
+        if (out != nullptr) {
+            out->write(data, length);
+            out->put('\n');
+            return;
+        }
+        if (buffer.size() + length + 1 > TEXT_BLOCK_SIZE)
+            flush();
+        buffer.insert(buffer.end(), data, data + length);
+        buffer.push_back('\n');
+    }
+
+    // returns false when a write failed, now or before.
+    bool flush() {
+        for (size_t done = 0; !failed && done < buffer.size();) {
+            ssize_t count = write(fd, buffer.data() + done, buffer.size() - done);
+            if (count == -1 && errno == EINTR)
+                continue;
+            if (count == -1) {
+                smashPerror("smash error: write failed");
+                failed = true;
+            } else {
+                done += count;
+            }
+        }
+        buffer.clear();
+        return !failed;
+    }
+
+    uint64_t written;
+
+private:
+    ostream *out;
+    int fd;
+    vector<char> buffer;
+    bool failed;
+};
+
+// merges the sources into sink. with -u only the first of each run of equal lines is kept.
+static void mergeSources(vector<SortSource *> &sources, const SortKeys &keys, SortSink &sink) {
+    LoserTree tree(sources, keys);
+    string last_text; // the lines of a run file move under the last one as the file is read.
+    SortLine last {};
+    bool have_last = false;
+    for (int winner; (winner = tree.winner()) != -1; tree.advanceWinner()) {
+        const char *text = sources[winner]->text;
+        const SortLine &line = sources[winner]->line;
+        if (keys.unique) {
+            if (have_last && keys.compare(last_text.data(), last, text, line) == 0)
+                continue;
+            last_text.assign(text + line.offset, line.length);
+            last = line;
+            last.offset = 0;
+            have_last = true;
+        }
+        sink.put(text + line.offset, line.length);
+    }
+}
+
+// ***********************************************************************************************************************************
+// **********************************                EXTERNAL SORTER               ***************************************************
+// ***********************************************************************************************************************************
+
+ExternalSorter::ExternalSorter(const SortKeys &keys, size_t memory_limit, unsigned int num_of_threads,
+                               int (*open_run_file)()) : keys(keys), memory_limit(memory_limit),
+                                                         num_of_threads(max(1u, num_of_threads)),
+                                                         open_run_file(open_run_file) {
+}
+
+ExternalSorter::~ExternalSorter() {
+    for (int fd : run_fds)
+        close(fd);
+}
+
+bool ExternalSorter::add(const char *data, size_t length) {
+    const char *end = data + length;
+    while (data < end) {
+        const char *newline = static_cast<const char *>(memchr(data, '\n', end - data));
+        size_t line_length = (newline == nullptr ? end : newline) - data;
+        size_t needed = text.size() + line_length + (lines.size() + 1) * sizeof(SortLine);
+        if (needed > memory_limit && !lines.empty() && !spillRun())
+            return false;
+        SortLine line;
+        line.offset = text.size();
+        line.length = line_length;
+        try {
+            // the text doubles as it fills, up to the limit, so a small sort only holds what it read. a line bigger
+            // than the limit is the only one in its run.
+            if (text.size() + line_length > text.capacity()) {
+                size_t grown = min(memory_limit, max((size_t) TEXT_BLOCK_SIZE, 2 * text.capacity()));
+                text.reserve(max(text.size() + line_length, grown));
+            }
+            lines.push_back(line);
+        } catch (const bad_alloc &) {
+            // there is less memory than the limit. the run so far goes to disk and the line gets an empty one.
+            if (!lines.empty()) {
+                if (!spillRun())
+                    return false;
+                continue;
+            }
+            errno = ENOMEM;
+            smashPerror("smash error: sort: line does not fit in memory");
+            return false;
+        }
+        text.insert(text.end(), data, data + line_length);
+        keys.fill(text.data(), lines.back());
+        stats.lines++;
+        stats.bytes += line_length + 1;
+        stats.peak_memory = max(stats.peak_memory, (uint64_t) (text.size() + lines.size() * sizeof(SortLine)));
+        data += line_length + 1;
+    }
+    return true;
+}
+
+vector<size_t> ExternalSorter::sortRun() {
+    size_t count = lines.size();
+    unsigned int threads = max((size_t) 1, min((size_t) num_of_threads, count / SORT_MIN_LINES_PER_THREAD));
+    const char *run_text = text.data();
+    auto less = [this, run_text](const SortLine &a, const SortLine &b) {
+        return keys.compare(run_text, a, run_text, b) < 0;
+    };
+    // -u keeps the first of equal lines, so their order has to be kept. otherwise equal lines are the same bytes.
+    auto sortSlice = [this, less](size_t begin, size_t end) {
+        if (keys.unique)
+            stable_sort(lines.begin() + begin, lines.begin() + end, less);
+        else
+            sort(lines.begin() + begin, lines.begin() + end, less);
+    };
+    vector<size_t> slice_ends;
+    vector<thread> workers;
+    for (unsigned int i = 0; i < threads; i++) {
+        size_t begin = count * i / threads, end = count * (i + 1) / threads;
+        slice_ends.push_back(end);
+        // the last slice is sorted by this thread, and so is any slice a thread could not be started for.
+        if (i + 1 < threads) {
+            try {
+                workers.emplace_back(sortSlice, begin, end);
+                continue;
+            } catch (const system_error &) {
+            }
+        }
+        sortSlice(begin, end);
+    }
+    for (thread &worker : workers)
+        worker.join();
+    stats.threads = max(stats.threads, (unsigned int) workers.size() + 1);
+    return slice_ends;
+}
+
+void ExternalSorter::mergeRun(const vector<size_t> &slice_ends, vector<SortSource *> &sources) {
+    size_t begin = 0;
+    for (size_t end : slice_ends) {
+        sources.push_back(new MemorySource(text.data(), lines.data() + begin, lines.data() + end));
+        begin = end;
+    }
+}
+
+bool ExternalSorter::spillRun() {
+    int fd = open_run_file();
+    if (fd == -1)
+        return false;
+    vector<SortSource *> sources;
+    mergeRun(sortRun(), sources);
+    SortSink sink(nullptr, fd);
+    mergeSources(sources, keys, sink);
+    for (SortSource *source : sources)
+        delete source;
+    if (!sink.flush()) {
+        close(fd);
+        return false;
+    }
+    run_fds.push_back(fd);
+    stats.runs++;
+    stats.spilled_bytes += sink.written;
+    text.clear();
+    lines.clear();
+    return true;
+}
+
+bool ExternalSorter::finish(ostream &out) {
+    // the runs in the files come first, so equal lines keep the order they were read in.
+    vector<SortSource *> sources;
+    bool read_all = true;
+    for (int fd : run_fds) {
+        if (lseek(fd, 0, SEEK_SET) == -1) {
+            smashPerror("smash error: lseek failed");
+            read_all = false;
+            break;
+        }
+        sources.push_back(new RunSource(fd, keys));
+    }
+    // the last run never goes to disk. its slices are merged with the runs.
+    if (read_all)
+        mergeRun(sortRun(), sources);
+    if (read_all) {
+        SortSink sink(&out, -1);
+        mergeSources(sources, keys, sink);
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+        if (i < run_fds.size() && static_cast<RunSource *>(sources[i])->reader.failed)
+            read_all = false;
+        delete sources[i];
+    }
+    return read_all;
+}
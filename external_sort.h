@@ -0,0 +1,143 @@
+#ifndef SMASH_EXTERNAL_SORT_H_
+#define SMASH_EXTERNAL_SORT_H_
+
+#include <ostream>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "text_scan.h"
+
+#define SORT_MEMORY_DEFAULT (256 * 1024 * 1024) // how much a sort holds in memory before it spills a run to disk.
+#define SORT_MIN_LINES_PER_THREAD 16384 // fewer lines than this are not worth another thread.
+
+// a line to sort, without its newline, and the key it is compared by. the key is found once, when the line is read.
+// the line is text[offset, offset + length) of the text it was read into, which may move as it grows.
+class SortLine {
+public:
+    uint64_t offset;
+    uint32_t length;
+    uint32_t key_begin; // the key is at key_begin in the line.
+    uint32_t key_length;
+    double number; // the key as a number, with -n.
+};
+
+// what sort compares: the whole line or the fields [first_field, last_field], as text or as numbers. bytes compare
+// as unsigned, like sort in the C locale. lines with equal keys are compared whole, unless only unique keys are kept.
+class SortKeys {
+public:
+    SortKeys() : numeric(false), reverse(false), reverse_lines(false), unique(false), separator(-1), first_field(0),
+                 last_field(0) {};
+
+    bool numeric;
+    bool reverse; // of the keys.
+    bool reverse_lines; // of the whole lines, when the keys are equal.
+    bool unique;
+    int separator; // the field separator, -1 for runs of blanks. a field then starts with the blanks before it.
+    unsigned int first_field; // from 1. 0 means the whole line.
+    unsigned int last_field; // 0 means to the end of the line.
+
+    // finds the key of a line whose offset and length are set.
+    void fill(const char *text, SortLine &line) const;
+
+    // < 0, 0 or > 0 for line a of a_text and line b of b_text. with unique, lines with equal keys are equal.
+    int compare(const char *a_text, const SortLine &a, const char *b_text, const SortLine &b) const;
+
+private:
+    // where field (from 1) starts in data[0, length), length when there are fewer fields.
+    size_t fieldStart(const char *data, size_t length, unsigned int field) const;
+
+    // where the field starting at pos ends.
+    size_t fieldEnd(const char *data, size_t length, size_t pos) const;
+};
+
+// one sorted sequence of lines for the merge.
+class SortSource {
+public:
+    SortSource() : text(nullptr), done(false) {};
+
+    virtual ~SortSource() = default;
+
+    // moves to the next line. done is set when there is none.
+    virtual void advance() = 0;
+
+    const char *text; // the text line is in.
+    SortLine line;
+    bool done;
+};
+
+// picks the smallest current line of k sorted sources with about log2(k) comparisons per line. every inner node keeps
+// the loser of the match played there, so after the winner advances only the matches on its path are played again.
+// equal lines are won by the source with the lower index, which keeps the merge stable.
+class LoserTree {
+public:
+    LoserTree(std::vector<SortSource *> &sources, const SortKeys &keys);
+
+    // the index of the source with the smallest line, -1 once every source is done.
+    int winner() const {
+        return sources.empty() || sources[tree[0]]->done ? -1 : tree[0];
+    }
+
+    // moves the winner on to its next line.
+    void advanceWinner();
+
+private:
+    std::vector<SortSource *> &sources;
+    const SortKeys &keys;
+    std::vector<int> tree; // tree[0] is the winner, tree[1..k-1] the losers of the inner nodes.
+
+    // whether source a comes before source b.
+    bool beats(int a, int b) const;
+};
+
+// what a sort did, for sort -v.
+class SortStats {
+public:
+    SortStats() : lines(0), bytes(0), runs(0), spilled_bytes(0), peak_memory(0), threads(1) {};
+
+    uint64_t lines;
+    uint64_t bytes;
+    unsigned int runs; // sorted runs written to temporary files.
+    uint64_t spilled_bytes;
+    uint64_t peak_memory; // of the lines and their records, at most the memory limit plus one block.
+    unsigned int threads; // the most a run was sorted with.
+};
+
+// sorts any amount of text in a bounded amount of memory. lines are collected until the limit is reached, then
+// sorted by several threads, each taking a slice, and the slices are merged into a run. a run which is not the last
+// is written to an unlinked temporary file. at the end the runs are merged with a loser tree, straight from the files.
+class ExternalSorter {
+public:
+    // open_run_file opens an unnamed temporary file for a run, or returns -1.
+    ExternalSorter(const SortKeys &keys, size_t memory_limit, unsigned int num_of_threads, int (*open_run_file)());
+
+    ~ExternalSorter();
+
+    // adds whole lines, as LineBlockReader hands them out. returns false when a run could not be spilled, or a line
+    // does not fit in memory on its own.
+    bool add(const char *data, size_t length);
+
+    // writes every line, sorted. returns false when a run could not be read back.
+    bool finish(std::ostream &out);
+
+    SortStats stats;
+
+private:
+    const SortKeys &keys;
+    size_t memory_limit;
+    unsigned int num_of_threads;
+    int (*open_run_file)();
+    std::vector<char> text; // the lines of the current run. it grows up to the limit as they come in.
+    std::vector<SortLine> lines;
+    std::vector<int> run_fds;
+
+    // sorts the current run with the threads, in slices. returns where each slice ends in lines.
+    std::vector<size_t> sortRun();
+
+    // adds a source for every sorted slice of the current run. they are the caller's to delete.
+    void mergeRun(const std::vector<size_t> &slice_ends, std::vector<SortSource *> &sources);
+
+    // sorts the current run into a temporary file and empties it.
+    bool spillRun();
+};
+
+#endif //SMASH_EXTERNAL_SORT_H_
@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+#include "Commands.h"
+
+using namespace std;
+
+static inline uint64_t recordSize(size_t command_length, size_t cwd_length) {
+    return (sizeof(HistoryRecord) + command_length + cwd_length + 7) & ~(uint64_t) 7;
+}
+
+History::~History() {
+    if (map != nullptr)
+        munmap(map, map_size);
+    if (fd != -1)
+        close(fd);
+}
+
+string History::defaultPath() {
+    const char *path = getenv("SMASH_HISTFILE");
+    if (path != nullptr)
+        return path;
+    const char *home = getenv("HOME");
+    return home == nullptr ? "" : string(home) + "/.smash_history";
+}
+
+bool History::open(const string &path) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        smashPerror("smash error: open failed");
+        return false;
+    }
+    struct stat st {};
+    bool valid = (flock(fd, LOCK_EX) == 0 && fstat(fd, &st) == 0);
+    // a new file gets its header, with the lock held so no other session writes one at the same time.
+    if (valid && st.st_size < HISTORY_DATA_OFFSET) {
+        st.st_size = HISTORY_GROW_SIZE;
+        valid = (ftruncate(fd, st.st_size) == 0 && remap(st.st_size));
+        if (valid) {
+            HistoryHeader *header = reinterpret_cast<HistoryHeader *>(map);
+            memcpy(header->magic, HISTORY_MAGIC, sizeof(header->magic));
+            header->end = HISTORY_DATA_OFFSET;
+        }
+    }
+    valid = valid && remap(st.st_size);
+    if (!valid) {
+        smashPerror("smash error: history: failed to map the history file");
+    } else if (memcmp(map, HISTORY_MAGIC, sizeof(HistoryHeader::magic)) != 0) {
+        string error_str = "smash error: history: " + path + " is not a history file";
+        smashPerror(error_str.c_str());
+        valid = false;
+    }
+    if (!valid) {
+        if (map != nullptr)
+            munmap(map, map_size);
+        map = nullptr;
+        map_size = 0;
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    indexRecords();
+    flock(fd, LOCK_UN);
+    return true;
+}
+
+bool History::remap(size_t size) {
+    if (size <= map_size)
+        return true;
+    void *new_map = (map == nullptr) ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                     : mremap(map, map_size, size, MREMAP_MAYMOVE);
+    if (new_map == MAP_FAILED)
+        return false;
+    map = static_cast<char *>(new_map);
+    map_size = size;
+    return true;
+}
+
+void History::indexRecords() {
+    uint64_t file_end = reinterpret_cast<HistoryHeader *>(map)->end;
+    // another session made the file bigger than the mapping.
+    if (file_end > map_size) {
+        struct stat st {};
+        if (fstat(fd, &st) == -1 || !remap(st.st_size))
+            return;
+        file_end = min(file_end, (uint64_t) map_size);
+    }
+    while (end + sizeof(HistoryRecord) <= file_end) {
+        const HistoryRecord *record = recordAt(end);
+        // a damaged record ends what can be read, appends still go after the end in the header.
+        if (record->size % 8 != 0 || record->size < recordSize(record->command_length, record->cwd_length) ||
+            end + record->size > file_end)
+            break;
+        offsets.push_back(end);
+        keys.push_back(keyOf(offsets.size() - 1));
+        end += record->size;
+    }
+}
+
+uint64_t History::keyOf(unsigned int index) const {
+    // the first 8 bytes of the command, big endian, zero padded.
+    uint64_t key = 0;
+    size_t length = commandLengthOf(index);
+    const unsigned char *command = reinterpret_cast<const unsigned char *>(commandOf(index));
+    for (size_t i = 0; i < 8; i++)
+        key = (key << 8) | (i < length ? command[i] : 0);
+    return key;
+}
+
+void History::sync() {
+    if (fd == -1 || flock(fd, LOCK_SH) == -1)
+        return;
+    indexRecords();
+    flock(fd, LOCK_UN);
+}
+
+bool History::append(const string &command, const string &cwd, int status, int64_t start_time,
+                     int64_t duration_ns) {
+    if (fd == -1)
+        return false;
+    if (flock(fd, LOCK_EX) == -1) {
+        smashPerror("smash error: flock failed");
+        return false;
+    }
+    indexRecords();
+    HistoryHeader *header = reinterpret_cast<HistoryHeader *>(map);
+    uint64_t size = recordSize(command.size(), cwd.size());
+    uint64_t record_end = header->end + size;
+    bool valid = true;
+    if (record_end > map_size) {
+        uint64_t file_size = (record_end + HISTORY_GROW_SIZE - 1) / HISTORY_GROW_SIZE * HISTORY_GROW_SIZE;
+        valid = (ftruncate(fd, file_size) == 0 && remap(file_size));
+        if (!valid)
+            smashPerror("smash error: history: failed to grow the history file");
+        header = reinterpret_cast<HistoryHeader *>(map);
+    }
+    if (valid) {
+        char *data = map + header->end;
+        HistoryRecord record {(uint32_t) size, status, start_time, duration_ns, (uint32_t) command.size(),
+                              (uint32_t) cwd.size()};
+        memcpy(data, &record, sizeof(record));
+        memcpy(data + sizeof(record), command.data(), command.size());
+        memcpy(data + sizeof(record) + command.size(), cwd.data(), cwd.size());
+        // the record is only part of the history once the end passes it.
+        header->end = record_end;
+        indexRecords();
+    }
+    flock(fd, LOCK_UN);
+    return valid;
+}
+
+bool History::entry(unsigned int number, HistoryEntry &result) const {
+    if (number == 0 || number > offsets.size())
+        return false;
+    result.number = number;
+    result.record = recordAt(offsets[number - 1]);
+    result.command = commandOf(number - 1);
+    result.cwd = result.command + result.record->command_length;
+    return true;
+}
+
+// a prefix of up to 8 bytes is compared with the keys alone, a longer one only where its first 8 bytes matched.
+class PrefixMatcher {
+public:
+    PrefixMatcher(const char *prefix, size_t length) : prefix(prefix), length(length), key(0), mask(0) {
+        for (size_t i = 0; i < 8; i++) {
+            key = (key << 8) | (i < length ? (unsigned char) prefix[i] : 0);
+            mask = (mask << 8) | (i < length ? 0xff : 0);
+        }
+    }
+
+    const char *prefix;
+    size_t length;
+    uint64_t key;
+    uint64_t mask;
+};
+
+bool History::startsWith(unsigned int index, const PrefixMatcher &matcher) const {
+    if ((keys[index] & matcher.mask) != matcher.key)
+        return false;
+    return matcher.length <= 8 || (commandLengthOf(index) >= matcher.length &&
+                                   memcmp(commandOf(index), matcher.prefix, matcher.length) == 0);
+}
+
+unsigned int History::findPrefix(const char *prefix, size_t length) const {
+    PrefixMatcher matcher(prefix, length);
+    for (size_t i = offsets.size(); i > 0; i--) {
+        if (startsWith(i - 1, matcher))
+            return i;
+    }
+    return 0;
+}
+
+vector<unsigned int> History::searchPrefix(const string &prefix) const {
+    PrefixMatcher matcher(prefix.data(), prefix.size());
+    vector<unsigned int> numbers;
+    for (size_t i = 0; i < offsets.size(); i++) {
+        if (startsWith(i, matcher))
+            numbers.push_back(i + 1);
+    }
+    return numbers;
+}
+
+vector<unsigned int> History::searchText(const string &text) const {
+    vector<unsigned int> numbers;
+    if (text.empty()) {
+        for (size_t i = 0; i < offsets.size(); i++)
+            numbers.push_back(i + 1);
+        return numbers;
+    }
+    uint64_t pos = HISTORY_DATA_OFFSET;
+    while (pos < end) {
+        const void *found = memmem(map + pos, end - pos, text.data(), text.size());
+        if (found == nullptr)
+            break;
+        uint64_t hit = static_cast<const char *>(found) - map;
+        // the record the hit is in. a hit in a record header or a working directory does not count.
+        size_t index = upper_bound(offsets.begin(), offsets.end(), hit) - offsets.begin() - 1;
+        uint64_t command_begin = offsets[index] + sizeof(HistoryRecord);
+        if (hit >= command_begin && hit + text.size() <= command_begin + commandLengthOf(index)) {
+            numbers.push_back(index + 1);
+            pos = offsets[index] + recordAt(offsets[index])->size;
+        } else {
+            pos = hit + 1;
+        }
+    }
+    return numbers;
+}
@@ -0,0 +1,118 @@
+#ifndef SMASH_HISTORY_H_
+#define SMASH_HISTORY_H_
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTORY_MAGIC "SMASHHI1"
+#define HISTORY_DATA_OFFSET 64 // the first record starts after the file header.
+#define HISTORY_GROW_SIZE (1024 * 1024) // the file grows by this much when an append does not fit.
+
+// the start of the history file. end is only written with the file locked.
+class HistoryHeader {
+public:
+    char magic[8];
+    uint64_t end; // offset right after the last record.
+};
+
+// one command in the history file, followed by the command and its working directory, padded to 8 bytes.
+class HistoryRecord {
+public:
+    uint32_t size; // of the whole record, padding included.
+    int32_t status;
+    int64_t start_time; // seconds since the epoch.
+    int64_t duration_ns;
+    uint32_t command_length;
+    uint32_t cwd_length;
+};
+
+// an entry as it is read back. the pointers are into the mapping and stay valid until the next append or sync.
+class HistoryEntry {
+public:
+    unsigned int number; // entries are numbered from 1, in the order they were added by every session.
+    const HistoryRecord *record;
+    const char *command;
+    const char *cwd;
+};
+
+class PrefixMatcher;
+
+// every command is appended to a file which is mapped, not parsed, when smash starts. several smash sessions may
+// append to the same file, under flock. entries are found through an index of record offsets, next to the first 8
+// bytes of every command, so prefix search mostly scans a small array instead of the mapping. substring search runs
+// memmem over the mapped records.
+class History {
+public:
+    History() : recording(false), fd(-1), map(nullptr), map_size(0), end(HISTORY_DATA_OFFSET) {};
+
+    ~History();
+
+    // $SMASH_HISTFILE, or ~/.smash_history.
+    static std::string defaultPath();
+
+    // opens or creates the history file and indexes what is in it.
+    bool open(const std::string &path);
+
+    bool isOpen() const {
+        return fd != -1;
+    }
+
+    // appends one command. entries other sessions appended since the last sync are indexed first.
+    bool append(const std::string &command, const std::string &cwd, int status, int64_t start_time,
+                int64_t duration_ns);
+
+    // indexes the entries other sessions appended.
+    void sync();
+
+    size_t size() const {
+        return offsets.size();
+    }
+
+    // entry number, from 1.
+    bool entry(unsigned int number, HistoryEntry &result) const;
+
+    // the newest entry whose command starts with prefix, 0 if there is none.
+    unsigned int findPrefix(const char *prefix, size_t length) const;
+
+    // the numbers of every entry with a command starting with prefix, oldest first.
+    std::vector<unsigned int> searchPrefix(const std::string &prefix) const;
+
+    // the numbers of every entry with a command containing text, oldest first.
+    std::vector<unsigned int> searchText(const std::string &text) const;
+
+    bool recording; // the commands smash runs are appended, not only read.
+
+private:
+    int fd;
+    char *map;
+    size_t map_size;
+    uint64_t end; // everything before this offset is indexed.
+    std::vector<uint64_t> offsets; // entry number - 1 -> offset of its record.
+    std::vector<uint64_t> keys; // entry number - 1 -> the first 8 bytes of its command.
+
+    // maps at least size bytes of the file.
+    bool remap(size_t size);
+
+    // indexes records up to the end in the header. the file must be locked.
+    void indexRecords();
+
+    uint64_t keyOf(unsigned int index) const;
+
+    bool startsWith(unsigned int index, const PrefixMatcher &matcher) const;
+
+    const HistoryRecord *recordAt(uint64_t offset) const {
+        return reinterpret_cast<const HistoryRecord *>(map + offset);
+    }
+
+    const char *commandOf(unsigned int index) const {
+        return map + offsets[index] + sizeof(HistoryRecord);
+    }
+
+    size_t commandLengthOf(unsigned int index) const {
+        return recordAt(offsets[index])->command_length;
+    }
+};
+
+#endif //SMASH_HISTORY_H_
@@ -0,0 +1,75 @@
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "input_reader.h"
+
+using namespace std;
+
+void InputReader::open(int input_fd) {
+    fd = input_fd;
+    begin = end = scanned = 0;
+    at_eof = (fd == -1);
+    line_mode = (fd != -1 && isatty(fd));
+    buffer.resize(line_mode ? LINE_MODE_CHUNK_SIZE : READ_CHUNK_SIZE);
+}
+
+void InputReader::reserve(size_t size) {
+    if (buffer.size() - end >= size)
+        return;
+    // the consumed lines at the front are dropped first, the buffer only grows for lines longer than it.
+    if (begin > 0) {
+        memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        scanned -= begin;
+        begin = 0;
+    }
+    if (buffer.size() - end < size)
+        buffer.resize(max(buffer.size() * 2, end + size));
+}
+
+void InputReader::feed(const string &commands) {
+    reserve(commands.size() + 1);
+    memcpy(buffer.data() + end, commands.data(), commands.size());
+    end += commands.size();
+    buffer[end++] = '\n';
+    scan();
+}
+
+void InputReader::scan() {
+    const void *newline = memchr(buffer.data() + scanned, '\n', end - scanned);
+    scanned = newline == nullptr ? end : static_cast<const char *>(newline) - buffer.data();
+}
+
+bool InputReader::fill() {
+    if (at_eof)
+        return false;
+    if (begin == end)
+        begin = end = scanned = 0;
+    size_t chunk_size = line_mode ? LINE_MODE_CHUNK_SIZE : READ_CHUNK_SIZE;
+    reserve(chunk_size);
+    ssize_t input_read = read(fd, buffer.data() + end, chunk_size);
+    if (input_read > 0) {
+        end += input_read;
+        scan();
+    } else if (input_read == 0 || (errno != EAGAIN && errno != EINTR)) {
+        at_eof = true;
+    }
+    return !at_eof;
+}
+
+bool InputReader::nextLine(LineView &line) {
+    if (!hasLine())
+        return false;
+    line.data = buffer.data() + begin;
+    if (scanned < end) {
+        line.length = scanned - begin;
+        begin = scanned + 1;
+        scanned = begin;
+        scan();
+    } else {
+        // the last line of the input may not end with a newline.
+        line.length = end - begin;
+        begin = scanned = end;
+    }
+    return true;
+}
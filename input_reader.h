@@ -0,0 +1,68 @@
+#ifndef SMASH_INPUT_READER_H_
+#define SMASH_INPUT_READER_H_
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+#define READ_CHUNK_SIZE (256 * 1024) // how much is read at once from a file or a pipe.
+#define LINE_MODE_CHUNK_SIZE 4096 // a terminal returns at most one line per read anyway.
+
+// a line inside the reader's buffer, without its newline. it stays valid until the next call to fill or feed.
+class LineView {
+public:
+    const char *data;
+    size_t length;
+};
+
+// reads commands in large blocks and splits them into lines in place, so a line is never copied on its way to the
+// parser. a line longer than the buffer grows it, so there is no limit on the length of a line.
+class InputReader {
+public:
+    InputReader() : fd(-1), begin(0), end(0), scanned(0), at_eof(true), line_mode(false) {};
+
+    // starts reading from fd. -1 means there is nothing to read but what feed gives.
+    void open(int input_fd);
+
+    // adds commands before anything not read yet, each ending with a newline.
+    void feed(const std::string &commands);
+
+    // reads once from the fd. returns false when the input has ended.
+    bool fill();
+
+    // the next complete line. once the input ended, the last line is returned even without a newline.
+    bool nextLine(LineView &line);
+
+    bool hasLine() const {
+        return scanned < end || (at_eof && begin < end);
+    }
+
+    bool ended() const {
+        return at_eof;
+    }
+
+    int inputFd() const {
+        return fd;
+    }
+
+    bool lineMode() const {
+        return line_mode;
+    }
+
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t begin; // the unread data is buffer[begin, end).
+    size_t end;
+    size_t scanned; // buffer[begin, scanned) holds no newline, so memchr starts from here.
+    bool at_eof;
+    bool line_mode; // the input is a terminal: it is read a line at a time.
+
+    // makes room for size more bytes after end.
+    void reserve(size_t size);
+
+    // moves scanned to the next newline, or to end when there is none.
+    void scan();
+};
+
+#endif //SMASH_INPUT_READER_H_
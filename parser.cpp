@@ -0,0 +1,361 @@
+#include <string.h>
+#include "parser.h"
+
+using namespace std;
+
+static inline bool isWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// characters which end a word, because they start an operator smash handles itself.
+static inline bool isOperator(char c) {
+    return c == '|' || c == '>' || c == '<' || c == '&';
+}
+
+// unquoted characters that need a real shell: globbing, expansions, lists, subshells, comments.
+static inline bool isShellSpecial(char c) {
+    return strchr("*?[]~$`;(){}!#", c) != nullptr;
+}
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+unsigned int ParsedLine::lexRedirection(unsigned int pos, int fd) {
+    unsigned int length = line.size();
+    bool both = false;
+    Redirection redirection {REDIRECT_OUT, fd, -1, (unsigned int) tokens.size(), false, false, 0, 0, 0};
+    if (line[pos] == '<' && pos + 2 < length && line[pos + 1] == '<' && line[pos + 2] == '<') {
+        redirection.type = REDIRECT_HERE_STRING;
+        pos += 3;
+    } else if (line[pos] == '<' && pos + 1 < length && line[pos + 1] == '<') {
+        redirection.type = REDIRECT_HERE_DOC;
+        pos += 2;
+        if (pos < length && line[pos] == '-') {
+            redirection.strip_tabs = true;
+            pos++;
+        }
+    } else if (line[pos] == '<') {
+        redirection.type = REDIRECT_IN;
+        pos++;
+    } else if (line[pos] == '&') {
+        // &> and &>>.
+        both = true;
+        pos += 2;
+        if (pos < length && line[pos] == '>') {
+            redirection.type = REDIRECT_APPEND;
+            pos++;
+        }
+    } else if (pos + 1 < length && line[pos + 1] == '>') {
+        redirection.type = REDIRECT_APPEND;
+        pos += 2;
+    } else if (pos + 2 < length && line[pos + 1] == '&' && isDigit(line[pos + 2])) {
+        redirection.type = REDIRECT_DUP;
+        redirection.source_fd = line[pos + 2] - '0';
+        pos += 3;
+    } else if (pos + 1 < length && line[pos + 1] == '&') {
+        // >& file is &> file.
+        both = true;
+        pos += 2;
+    } else {
+        pos++;
+    }
+    if (both)
+        redirection.fd = REDIRECT_BOTH;
+    else if (fd == -1)
+        redirection.fd = (redirection.type == REDIRECT_IN || redirection.type >= REDIRECT_HERE_DOC) ? 0 : 1;
+    redirections.push_back(redirection);
+    return pos;
+}
+
+unsigned int ParsedLine::lexSubstitution(unsigned int pos, Token &token, unsigned int &num_of_substitutions) {
+    unsigned int length = line.size();
+    Substitution substitution {(unsigned int) tokens.size(), SUBSTITUTION_FD - (int) num_of_substitutions,
+                               line[pos] == '>', pos + 2, pos + 2};
+    // the command ends at the parenthesis which closes the first one, outside of quotes.
+    unsigned int depth = 1;
+    pos += 2;
+    while (pos < length && depth > 0) {
+        char c = line[pos];
+        if (c == '\'' || c == '"') {
+            size_t close = line.find(c, pos + 1);
+            pos = (close == string::npos) ? length : close + 1;
+            continue;
+        }
+        if (c == '\\')
+            pos++;
+        else if (c == '(')
+            depth++;
+        else if (c == ')')
+            depth--;
+        pos++;
+    }
+    if (pos > length)
+        pos = length;
+    substitution.command_end = pos - (depth == 0);
+    token.type = TOKEN_WORD;
+    token.text = words_buffer.size();
+    // an unclosed one, or one too many, is bash's to run or to complain about.
+    if (depth > 0 || num_of_substitutions == SUBSTITUTION_MAX) {
+        token.needs_shell = true;
+        words_buffer.append(line, token.begin, pos - token.begin);
+    } else {
+        words_buffer.append("/dev/fd/" + to_string(substitution.fd));
+        substitutions.push_back(substitution);
+        num_of_substitutions++;
+    }
+    words_buffer.push_back('\0');
+    return pos;
+}
+
+// a single pass over the line. quotes are removed from the words, so the words can be passed to exec as they are,
+// and operators inside quotes are plain text.
+void ParsedLine::lex() {
+    tokens.clear();
+    words_buffer.clear();
+    redirections.clear();
+    substitutions.clear();
+    unsigned int length = line.size(), pos = 0, num_of_substitutions = 0;
+    command_end = length;
+    missing_bodies = false;
+    bool here_doc = false;
+    while (pos < length) {
+        char c = line[pos];
+        // with a here document, the command ends with its line. whatever follows are the bodies.
+        if (c == '\n' && here_doc) {
+            command_end = pos;
+            break;
+        }
+        if (isWhitespace(c)) {
+            pos++;
+            continue;
+        }
+        Token token {};
+        token.begin = pos;
+        if (c == '|') {
+            bool to_stderr = (pos + 1 < length && line[pos + 1] == '&');
+            token.type = to_stderr ? TOKEN_PIPE_STDERR : TOKEN_PIPE;
+            pos += to_stderr ? 2 : 1;
+            num_of_substitutions = 0;
+        } else if ((c == '<' || c == '>') && pos + 1 < length && line[pos + 1] == '(') {
+            pos = lexSubstitution(pos, token, num_of_substitutions);
+        } else if (c == '>' || c == '<' || (c == '&' && pos + 1 < length && line[pos + 1] == '>')) {
+            token.type = TOKEN_REDIRECT;
+            pos = lexRedirection(pos, -1);
+            here_doc = here_doc || redirections.back().type == REDIRECT_HERE_DOC;
+        } else if (isDigit(c) && pos + 1 < length && (line[pos + 1] == '>' || line[pos + 1] == '<')) {
+            // 2> and the like: a single digit right before the operator is the fd it redirects.
+            token.type = TOKEN_REDIRECT;
+            pos = lexRedirection(pos + 1, c - '0');
+            here_doc = here_doc || redirections.back().type == REDIRECT_HERE_DOC;
+        } else if (c == '&') {
+            token.type = TOKEN_BACKGROUND;
+            pos++;
+        } else {
+            token.type = TOKEN_WORD;
+            token.text = words_buffer.size();
+            while (pos < length && !isWhitespace(line[pos]) && !isOperator(line[pos])) {
+                c = line[pos];
+                if (c == '\'') {
+                    // everything up to the closing quote is literal.
+                    size_t close = line.find('\'', pos + 1);
+                    if (close == string::npos) {
+                        token.needs_shell = true;
+                        close = length;
+                    }
+                    words_buffer.append(line, pos + 1, close - pos - 1);
+                    pos = close + 1;
+                } else if (c == '"') {
+                    // expansions and escapes still work inside double quotes, so those are left to bash.
+                    pos++;
+                    while (pos < length && line[pos] != '"') {
+                        if (line[pos] == '$' || line[pos] == '`' || line[pos] == '\\')
+                            token.needs_shell = true;
+                        words_buffer.push_back(line[pos++]);
+                    }
+                    if (pos == length)
+                        token.needs_shell = true;
+                    pos++;
+                } else if (c == '\\') {
+                    // an escaped character never ends the word.
+                    token.needs_shell = true;
+                    words_buffer.append(line, pos, 2);
+                    pos += 2;
+                } else {
+                    if (isShellSpecial(c))
+                        token.needs_shell = true;
+                    words_buffer.push_back(c);
+                    pos++;
+                }
+            }
+            if (pos > length)
+                pos = length;
+            words_buffer.push_back('\0');
+        }
+        token.end = pos;
+        tokens.push_back(token);
+    }
+    if (here_doc)
+        scanBodies(command_end);
+}
+
+// the delimiter of a here document is never expanded. quoting any of it only means the body is not expanded either.
+void ParsedLine::scanBodies(unsigned int pos) {
+    unsigned int length = line.size();
+    unsigned int next_line = (pos < length) ? pos + 1 : length;
+    for (Redirection &redirection : redirections) {
+        unsigned int i = redirection.token + 1;
+        if (redirection.type != REDIRECT_HERE_DOC || i >= tokens.size() || tokens[i].type != TOKEN_WORD)
+            continue;
+        string delimiter = hereDelimiter(redirection);
+        bool quoted = (line.find_first_of("'\"\\", tokens[i].begin) < tokens[i].end);
+        tokens[i].needs_shell = false;
+
+        redirection.body = next_line;
+        redirection.body_length = length - next_line;
+        redirection.body_end = length;
+        missing_bodies = true;
+        while (next_line < length) {
+            unsigned int line_begin = next_line, line_end = line.find('\n', next_line);
+            if (line_end == string::npos)
+                line_end = length;
+            next_line = (line_end < length) ? line_end + 1 : length;
+            unsigned int text_begin = line_begin;
+            while (redirection.strip_tabs && text_begin < line_end && line[text_begin] == '\t')
+                text_begin++;
+            if (line.compare(text_begin, line_end - text_begin, delimiter) == 0) {
+                redirection.body_length = line_begin - redirection.body;
+                redirection.body_end = next_line;
+                missing_bodies = false;
+                break;
+            }
+        }
+        if (missing_bodies)
+            break;
+        // an unquoted delimiter lets bash expand the body, which only matters when there is something to expand.
+        size_t expansion = line.find_first_of("$`\\", redirection.body);
+        redirection.by_shell = !quoted && expansion < redirection.body + redirection.body_length;
+        tokens[redirection.token].needs_shell = redirection.by_shell;
+    }
+}
+
+bool ParsedLine::parse(const char *cmd_line, size_t length) {
+    line.assign(cmd_line, length);
+    lex();
+    stages.clear();
+    background = false;
+    if (tokens.empty())
+        return false;
+
+    unsigned int end = tokens.size();
+    if (tokens[end - 1].type == TOKEN_BACKGROUND) {
+        background = true;
+        end--;
+    }
+    // a redirection belongs to the stage it is in. the file name is the word right after it.
+    for (Redirection &redirection : redirections) {
+        unsigned int i = redirection.token;
+        if (redirection.type == REDIRECT_DUP)
+            continue;
+        if (i + 1 >= end || tokens[i + 1].type != TOKEN_WORD)
+            return false;
+        tokens[i + 1].type = TOKEN_REDIRECT_TARGET;
+        // a target which needs bash (an expansion, or a ; stuck to it) is left to bash with its redirection, like a
+        // here document with expansions in its body.
+        if (redirection.type != REDIRECT_HERE_DOC) {
+            redirection.by_shell = tokens[i + 1].needs_shell;
+            tokens[i].needs_shell = redirection.by_shell;
+        }
+    }
+
+    unsigned int first = 0, next_redirection = 0;
+    for (unsigned int i = 0; i <= end; i++) {
+        bool is_pipe = (i < end && (tokens[i].type == TOKEN_PIPE || tokens[i].type == TOKEN_PIPE_STDERR));
+        if (!is_pipe && i < end) {
+            // a & which does not end the line (a & b) is a list, which only bash runs.
+            if (tokens[i].type == TOKEN_BACKGROUND)
+                tokens[i].needs_shell = true;
+            continue;
+        }
+        Stage stage {first, i, is_pipe && tokens[i].type == TOKEN_PIPE_STDERR, next_redirection, next_redirection};
+        while (stage.end_redirection < redirections.size() && redirections[stage.end_redirection].token < i)
+            stage.end_redirection++;
+        next_redirection = stage.end_redirection;
+        if (nextWord(first, i) == i)
+            return false;
+        stages.push_back(stage);
+        first = i + 1;
+    }
+    return true;
+}
+
+unsigned int ParsedLine::nextWord(unsigned int token, unsigned int end) const {
+    while (token < end && tokens[token].type != TOKEN_WORD)
+        token++;
+    return token;
+}
+
+// a redirection bash applies is the only one with needs_shell on its operator.
+string ParsedLine::rawText(unsigned int first, unsigned int end) const {
+    string text;
+    for (unsigned int i = first; i < end; i++) {
+        TokenType type = tokens[i].type;
+        if (type == TOKEN_REDIRECT && !tokens[i].needs_shell)
+            continue;
+        if (type == TOKEN_REDIRECT_TARGET && !tokens[i - 1].needs_shell)
+            continue;
+        if (type == TOKEN_BACKGROUND && i + 1 == tokens.size())
+            continue;
+        if (!text.empty())
+            text.push_back(' ');
+        text.append(line, tokens[i].begin, tokens[i].end - tokens[i].begin);
+    }
+    for (const Redirection &redirection : redirections) {
+        if (redirection.type == REDIRECT_HERE_DOC && redirection.by_shell && redirection.token >= first &&
+            redirection.token < end) {
+            text.push_back('\n');
+            text.append(line, redirection.body, redirection.body_end - redirection.body);
+        }
+    }
+    return text;
+}
+
+string ParsedLine::hereDelimiter(const Redirection &redirection) const {
+    string delimiter;
+    for (const char *c = target(redirection); *c != '\0'; c++) {
+        if (*c == '\\' && c[1] != '\0')
+            c++;
+        delimiter.push_back(*c);
+    }
+    return delimiter;
+}
+
+string ParsedLine::hereBody(const Redirection &redirection) const {
+    if (redirection.type == REDIRECT_HERE_STRING)
+        return string(target(redirection)) + '\n';
+    if (!redirection.strip_tabs)
+        return line.substr(redirection.body, redirection.body_length);
+    string body;
+    unsigned int pos = redirection.body, end = redirection.body + redirection.body_length;
+    while (pos < end) {
+        while (pos < end && line[pos] == '\t')
+            pos++;
+        size_t line_end = line.find('\n', pos);
+        line_end = (line_end < end) ? line_end + 1 : end;
+        body.append(line, pos, line_end - pos);
+        pos = line_end;
+    }
+    return body;
+}
+
+bool ParsedLine::needsShell(unsigned int first, unsigned int end) const {
+    unsigned int first_word = nextWord(first, end);
+    // a variable assignment before the command (FOO=bar cmd).
+    if (first_word < end && line.find('=', tokens[first_word].begin) < tokens[first_word].end)
+        return true;
+    for (unsigned int i = first; i < end; i++) {
+        if (tokens[i].needs_shell)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,130 @@
+#ifndef SMASH_PARSER_H_
+#define SMASH_PARSER_H_
+
+#include <string>
+#include <vector>
+
+enum TokenType {
+    TOKEN_WORD, TOKEN_PIPE, TOKEN_PIPE_STDERR, TOKEN_REDIRECT, TOKEN_BACKGROUND,
+    TOKEN_REDIRECT_TARGET // the file name after a redirection, which is not an argument of the command.
+};
+
+enum RedirectType {
+    REDIRECT_IN, // [n]< file
+    REDIRECT_OUT, // [n]> file, &> file
+    REDIRECT_APPEND, // [n]>> file, &>> file
+    REDIRECT_DUP, // [n]>&m
+    REDIRECT_HERE_DOC, // [n]<<WORD or [n]<<-WORD, with the lines after the command up to WORD as the input.
+    REDIRECT_HERE_STRING // [n]<<< word, with the word and a newline as the input.
+};
+
+#define REDIRECT_BOTH (-1) // the fd of &> and &>>, which redirect stdout and stderr together.
+#define SUBSTITUTION_FD 63 // a command's first <(cmd) or >(cmd) is /dev/fd/63, the next ones count down, like in bash.
+#define SUBSTITUTION_MAX 16 // more than this in one command are left to bash.
+
+class Token {
+public:
+    TokenType type;
+    unsigned int text; // words only: offset of the word, unquoted and NUL terminated, in ParsedLine::words_buffer.
+    unsigned int begin; // where the token is in the line as typed.
+    unsigned int end;
+    bool needs_shell; // the token uses syntax smash leaves to bash (globbing, expansions, ;, a & in the middle...).
+};
+
+class Redirection {
+public:
+    RedirectType type;
+    int fd; // the fd of the command which is redirected.
+    int source_fd; // REDIRECT_DUP only: the fd copied onto fd.
+    unsigned int token; // token index of the operator. the file name is the token after it.
+    bool strip_tabs; // <<- removes the leading tabs of the body lines and of the delimiter.
+    bool by_shell; // the target needs expansions, so a command run by bash leaves the redirection to bash.
+    unsigned int body; // here documents: the body is line[body, body + body_length), without the delimiter line.
+    unsigned int body_length;
+    unsigned int body_end; // after the delimiter line.
+};
+
+// <(cmd) or >(cmd). it is a word of its own, whose text is the path the command gets instead: /dev/fd/ and the fd
+// one end of a pipe is put on. cmd runs with the other end as its stdout, or its stdin for >(cmd).
+class Substitution {
+public:
+    unsigned int token;
+    int fd;
+    bool to_command; // >(cmd): what the command writes to the path is the input of cmd.
+    unsigned int command_begin; // cmd is line[command_begin, command_end).
+    unsigned int command_end;
+};
+
+// a command of a pipeline, as a range of tokens [first_token, end_token) with the separators left out.
+class Stage {
+public:
+    unsigned int first_token;
+    unsigned int end_token;
+    bool stderr_pipe; // the stage sends its stderr (not stdout) to the next one (|&).
+    unsigned int first_redirection; // the redirections of the stage are [first_redirection, end_redirection) of
+    unsigned int end_redirection; // ParsedLine::redirections, in the order they are applied.
+};
+
+// the result of scanning a line once. words point into a buffer owned by the object and all the vectors keep their
+// capacity between lines, so parsing a line in a reused ParsedLine does not allocate once it is warm.
+class ParsedLine {
+public:
+    ParsedLine() : background(false), command_end(0), missing_bodies(false) {};
+
+    std::string line;
+    std::string words_buffer;
+    std::vector<Token> tokens;
+    std::vector<Stage> stages;
+    std::vector<Redirection> redirections;
+    std::vector<Substitution> substitutions;
+    bool background; // the line ends with &.
+    unsigned int command_end; // where the command ends. here document bodies follow it, after a newline.
+    bool missing_bodies; // the text ended before the delimiter of a here document.
+
+    // returns false when the line has no command at all, or a pipe with an empty side.
+    bool parse(const char *cmd_line, size_t length);
+
+    bool parse(const std::string &cmd_line) {
+        return parse(cmd_line.data(), cmd_line.size());
+    }
+
+    const char *word(unsigned int token) const {
+        return words_buffer.data() + tokens[token].text;
+    }
+
+    // the file name of a redirection which is not a dup.
+    const char *target(const Redirection &redirection) const {
+        return word(redirection.token + 1);
+    }
+
+    // the first word at or after token, or end when there is none.
+    unsigned int nextWord(unsigned int token, unsigned int end) const;
+
+    // the text of tokens [first, end) as typed, without redirections and a trailing &. redirections left to bash
+    // stay, and the bodies of such here documents follow on the next lines.
+    std::string rawText(unsigned int first, unsigned int end) const;
+
+    // the line which ends a here document, with its quotes and escapes removed.
+    std::string hereDelimiter(const Redirection &redirection) const;
+
+    // the input of a here document or here string, as the command reads it.
+    std::string hereBody(const Redirection &redirection) const;
+
+    // the tokens [first, end) can only be run by bash.
+    bool needsShell(unsigned int first, unsigned int end) const;
+
+private:
+    void lex();
+
+    // the redirection operator at pos, where fd is the number in front of it or -1. returns the position after it.
+    unsigned int lexRedirection(unsigned int pos, int fd);
+
+    // finds the body of every here document in the lines from pos on.
+    void scanBodies(unsigned int pos);
+
+    // the substitution starting at pos, which is the <( or >(. num_of_substitutions counts those of the current stage.
+    // returns the position after its closing parenthesis.
+    unsigned int lexSubstitution(unsigned int pos, Token &token, unsigned int &num_of_substitutions);
+};
+
+#endif //SMASH_PARSER_H_
@@ -11,25 +11,25 @@ using namespace std;
 
 void ctrlZHandler(int sig_num) {
     SmallShell &smash = SmallShell::getInstance();
-    smash.jobs.removeFinishedJobs();
     int curr_pid = smash.current_fg_pid;
-    cout << "smash: got ctrl-Z" << endl;
+    cout << "smash: got ctrl-Z" << '\n';
     // nothing is in the foreground now.
     if (curr_pid == -1)
         return;
+    // the foreground pid leads its process group, which holds every stage of a pipeline.
     int return_value;
-    SYS_CALL(return_value, kill(curr_pid, SIGSTOP));
-    cout << "smash: process " << curr_pid << " was stopped" << endl;
+    SYS_CALL(return_value, killpg(curr_pid, SIGSTOP));
+    cout << "smash: process " << curr_pid << " was stopped" << '\n';
     JobEntry *job = smash.jobs.getJobByPId(curr_pid);
     // if job is not in the list, add it
     if (job == nullptr) {
         smash.jobs.addJob(smash.curr_fg_command, curr_pid, true);
     } else {
-        job->is_stopped = true;
+        smash.jobs.setStopped(job, true);
         job->start_time = time(nullptr); // reset the time of the job after it has stopped.
     }
 
-    smash.jobs.getJobByPId(curr_pid)->is_stopped = true;
+    smash.jobs.setStopped(smash.jobs.getJobByPId(curr_pid), true);
     smash.current_fg_pid = -1;
     smash.curr_fg_command = nullptr;
 }
@@ -37,36 +37,35 @@ void ctrlZHandler(int sig_num) {
 void ctrlCHandler(int sig_num) {
     SmallShell &smash = SmallShell::getInstance();
     int curr_pid = smash.current_fg_pid;
-    cout << "smash: got ctrl-C" << endl;
+    cout << "smash: got ctrl-C" << '\n';
     // nothing in fg.
     if (curr_pid == -1)
         return;
     int return_value;
-    SYS_CALL(return_value, kill(curr_pid, SIGKILL));
+    SYS_CALL(return_value, killpg(curr_pid, SIGKILL));
 
-    cout << "smash: process " << curr_pid << " was killed" << endl;
+    cout << "smash: process " << curr_pid << " was killed" << '\n';
 }
 
 void alarmHandler(int sig_num) {
     SmallShell &smash = SmallShell::getInstance();
-    if (smash.time_out_list.timeout_list.empty())
-        return;
-    int pid = smash.time_out_list.timeout_list.begin()->pid;
-    // this alarm job has removed from the jobs list so remove it.
-    if(smash.time_out_list.timeout_list.begin()->is_timeout_bg && smash.jobs.getJobByPId(pid) == nullptr) {
-        smash.time_out_list.remove_entry(pid);
-        return;
-    }
+    TimeOutList::TimeOutEntry *timeout;
+    // handle every timeout which is due, anything else is a stray SIGALRM.
+    while ((timeout = smash.time_out_list.top()) != nullptr && timeout->kill_time <= TimeOutList::now()) {
+        int pid = timeout->pid;
+        // this alarm job has removed from the jobs list so remove it.
+        if (timeout->is_timeout_bg && smash.jobs.getJobByPId(pid) == nullptr) {
+            smash.time_out_list.remove_entry(pid);
+            continue;
+        }
 
-    cout << "smash: got an alarm" << endl;
-    int return_value;
-
-    SYS_CALL(return_value, kill(pid, sig_num));
-    cout << "smash: " << smash.time_out_list.timeout_list.begin()->un_proccessed_cmd << " timed out!" << endl;
-    smash.time_out_list.timeout_list.erase(smash.time_out_list.timeout_list.begin()); // remove the recent timeout alarm.
-    // set up new alarm for the next entry, if one exists.
-    if (!smash.time_out_list.timeout_list.empty()) {
-        alarm(difftime(smash.time_out_list.timeout_list.begin()->kill_time, time(nullptr)));
+        cout << "smash: got an alarm" << '\n';
+        if (kill(pid, sig_num) == -1)
+            smashPerror("smash error: kill failed");
+        else
+            cout << "smash: " << timeout->un_proccessed_cmd << " timed out!" << '\n';
+        // remove the recent timeout alarm, which also sets up the timer for the next entry, if one exists.
+        smash.time_out_list.pop();
+        smash.jobs.removeJobByPId(pid);
     }
-    smash.jobs.removeJobByPId(pid);
-}
\ No newline at end of file
+}
@@ -1,29 +1,57 @@
 #include <iostream>
 #include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include "Commands.h"
 #include "signals.h"
 
+// smash              - commands from stdin, with a prompt before each one.
+// smash script.sh    - commands from the script, no prompts, exits with the status of the last command.
+// smash -c 'cmds'    - the same for commands given on the command line, one per line.
 int main(int argc, char *argv[]) {
 
-    if (signal(SIGTSTP, ctrlZHandler) == SIG_ERR)
-        perror("smash error: failed to set ctrl-Z handler");
-    if (signal(SIGINT, ctrlCHandler) == SIG_ERR)
-        perror("smash error: failed to set ctrl-C handler");
-    struct sigaction sig_action {};
-    sig_action.sa_flags = SA_RESTART;
-    sig_action.sa_handler = alarmHandler;
+    SmallShell &smash = SmallShell::getInstance();
+    int input_fd = STDIN_FILENO;
+    bool batch = (argc > 1);
+    if (batch && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            std::cerr << "smash error: -c: option requires an argument" << std::endl;
+            return 2;
+        }
+        input_fd = -1;
+    } else if (batch) {
+        // the script must not leak into the commands it runs.
+        input_fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (input_fd == -1) {
+            std::string error_str = std::string("smash error: ") + argv[1];
+            perror(error_str.c_str());
+            return 127;
+        }
+    }
 
-    if (sigaction(SIGALRM, &sig_action, nullptr))
-        perror("smash error: failed to set alarm handler");
+    smash.bufferOutput();
+    // ctrl-Z, ctrl-C, alarms and child events are handled by the event loop, not by signal handlers.
+    if (!smash.event_loop.init(input_fd))
+        perror("smash error: failed to set up the event loop");
+    if (input_fd == -1)
+        smash.event_loop.feedInput(argv[2]);
+    // interactive sessions record what they run, and so does any session given SMASH_HISTFILE.
+    if (!batch && (isatty(STDIN_FILENO) || getenv("SMASH_HISTFILE") != nullptr) && !History::defaultPath().empty())
+        smash.history.recording = smash.history.open(History::defaultPath());
 
-    SmallShell &smash = SmallShell::getInstance();
     while (true) {
-        std::cout << smash.prompt;
-        string cmd_line;
-        std::getline(std::cin, cmd_line);
-        smash.executeCommand(cmd_line);
+        if (!batch)
+            std::cout << smash.prompt << std::flush;
+        LineView cmd_line;
+        if (!smash.event_loop.readLine(cmd_line))
+            break;
+        smash.executeInputLine(cmd_line.data, cmd_line.length);
+        // perror writes to stderr right away, so the output of a line is written before the next one runs.
+        std::cout.flush();
     }
-    return 0;
-}
\ No newline at end of file
+    // the output of the commands is flushed by exit, like quit does.
+    return batch ? smash.last_status : 0;
+}
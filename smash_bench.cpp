@@ -0,0 +1,388 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Commands.h"
+
+using namespace std;
+
+// every result is printed as one line of key=value pairs, so runs can be compared by scripts.
+
+// results of the measured calls go here, so the compiler cannot drop them.
+static volatile long sink;
+
+static double now_ns() {
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const string &suite, const string &op, long n, double total_ns) {
+    cout << "suite=" << suite << " op=" << op << " n=" << n << " ns_per_op=" << (long) (total_ns / n) << endl;
+}
+
+static void reportLatency(const string &suite, const string &op, vector<double> &samples) {
+    sort(samples.begin(), samples.end());
+    cout << "suite=" << suite << " op=" << op << " n=" << samples.size()
+         << " p50_ns=" << (long) samples[samples.size() / 2] << " p99_ns=" << (long) samples[samples.size() * 99 / 100]
+         << endl;
+}
+
+static void reportBandwidth(const string &suite, const string &op, long bytes, double total_ns) {
+    cout << "suite=" << suite << " op=" << op << " bytes=" << bytes << " mb_per_sec="
+         << (long) (bytes / (1024.0 * 1024.0) * 1e9 / total_ns) << endl;
+}
+
+// a file of the given size in /tmp. the caller unlinks it.
+static string makeDataFile(size_t size) {
+    char path[] = "/tmp/smash-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("smash error: mkstemp failed");
+        return "";
+    }
+    string chunk(BUFFER_SIZE, 'x');
+    for (size_t written = 0; written < size; written += chunk.size()) {
+        if (write(fd, chunk.data(), chunk.size()) != (ssize_t) chunk.size()) {
+            perror("smash error: write failed");
+            break;
+        }
+    }
+    close(fd);
+    return path;
+}
+
+// JobsList operations with n jobs in the list. the pids are fake, nothing is ever signaled.
+static void benchJobs(int n) {
+    JobsList jobs;
+    string cmd_line = "sleep 100&";
+    ExternalCommand cmd(cmd_line);
+    cmd.un_proccessed_cmd = cmd_line;
+    const int base_pid = 1000000;
+    mt19937 rng(n);
+
+    double start = now_ns();
+    for (int i = 0; i < n; i++)
+        jobs.addJob(&cmd, base_pid + i, i % 10 == 0);
+    report("jobs", "add", n, now_ns() - start);
+
+    start = now_ns();
+    long found = 0;
+    for (int i = 0; i < n; i++)
+        found += (jobs.getJobById(1 + rng() % n) != nullptr);
+    report("jobs", "get_by_id", n, now_ns() - start);
+
+    start = now_ns();
+    for (int i = 0; i < n; i++)
+        found += (jobs.getJobByPId(base_pid + rng() % n) != nullptr);
+    report("jobs", "get_by_pid", n, now_ns() - start);
+
+    start = now_ns();
+    for (int i = 0; i < n; i++)
+        found += (jobs.getMaxJob() != nullptr) + (jobs.getLastStoppedJob() != nullptr);
+    report("jobs", "max_and_last_stopped", n, now_ns() - start);
+
+    start = now_ns();
+    for (int i = 0; i < n; i++)
+        jobs.update_max_id();
+    report("jobs", "update_max_id", n, now_ns() - start);
+
+    // listing every job into /dev/null, through the same kind of buffer as smash's cout.
+    int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd != -1) {
+        FdStreamBuf null_buf;
+        null_buf.open(null_fd);
+        streambuf *saved_buf = cout.rdbuf(&null_buf);
+        string jobs_line = "jobs";
+        JobsCommand jobs_cmd(jobs_line, &jobs);
+        start = now_ns();
+        jobs_cmd.execute();
+        cout.flush();
+        double total_ns = now_ns() - start;
+        cout.rdbuf(saved_buf);
+        close(null_fd);
+        report("jobs", "list", n, total_ns);
+    }
+
+    start = now_ns();
+    for (int i = 0; i < n; i += 2)
+        jobs.removeJobByPId(base_pid + i);
+    for (int i = 1; i < n; i += 2)
+        jobs.removeJobById(i + 1);
+    report("jobs", "remove", n, now_ns() - start);
+
+    sink = found;
+}
+
+// parsing typical lines n times with one ParsedLine, the way executeCommand reuses it.
+static void benchParser(int n) {
+    vector<string> lines = {"ls -l /tmp", "sleep 100&", "cat a.txt | grep -v \"a|b\" |& wc -l > out.txt",
+                            "timeout 5 echo 'hello world' >> log.txt", "ls *.cpp; echo $HOME"};
+    ParsedLine parsed;
+    for (auto &line : lines) {
+        long tokens = 0;
+        double start = now_ns();
+        for (int i = 0; i < n; i++) {
+            parsed.parse(line);
+            tokens += parsed.tokens.size();
+        }
+        report("parser", "parse_" + to_string(parsed.tokens.size()) + "_tokens", n, now_ns() - start);
+        sink = tokens;
+    }
+}
+
+// picking and building the command of an already parsed line, then freeing it, the way executeCommand does.
+static void benchDispatch(int n) {
+    SmallShell &smash = SmallShell::getInstance();
+    vector<string> lines = {"pwd", "showpid", "jobs", "pipestatus", "timeout 5 sleep 1", "ls -l /tmp"};
+    ParsedLine parsed;
+    for (auto &line : lines) {
+        parsed.parse(line);
+        long built = 0;
+        double start = now_ns();
+        for (int i = 0; i < n; i++) {
+            CommandArena::Mark mark = smash.command_arena.mark();
+            built += smash.CreateCommand(parsed)->cmd_line.size();
+            smash.command_arena.release(mark);
+        }
+        report("dispatch", "create_" + string(parsed.word(0)), n, now_ns() - start);
+        sink = built;
+    }
+}
+
+// splitting n generated lines read from a file, the way batch mode takes its commands.
+static void benchInput(int n) {
+    FILE *file = tmpfile();
+    if (file == nullptr) {
+        perror("smash error: tmpfile failed");
+        return;
+    }
+    string lines;
+    for (int i = 0; i < n; i++)
+        lines += "echo line " + to_string(i) + (i % 1000 == 0 ? string(5000, 'x') : string()) + "\n";
+    if (write(fileno(file), lines.data(), lines.size()) != (ssize_t) lines.size())
+        perror("smash error: write failed");
+    lseek(fileno(file), 0, SEEK_SET);
+
+    InputReader input;
+    input.open(fileno(file));
+    LineView line {};
+    long read_lines = 0, bytes = 0;
+    double start = now_ns();
+    while (true) {
+        if (input.nextLine(line)) {
+            read_lines++;
+            bytes += line.length;
+        } else if (!input.fill() && !input.hasLine()) {
+            break;
+        }
+    }
+    double total_ns = now_ns() - start;
+    report("input", "read_line", read_lines, total_ns);
+    cout << "suite=input op=throughput n=" << read_lines << " lines_per_sec=" << (long) (read_lines * 1e9 / total_ns)
+         << endl;
+    sink = bytes;
+    fclose(file);
+}
+
+// appending n commands to a new history file, mapping it again the way smash starts, and searching it.
+static void benchHistory(int n) {
+    char path[] = "/tmp/smash-bench-history-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("smash error: mkstemp failed");
+        return;
+    }
+    close(fd);
+    unlink(path);
+    vector<string> commands = {"ls -l /tmp", "make -j8 smash", "git status", "cat a.txt | grep -v b", "sleep 100&"};
+    {
+        History history;
+        if (!history.open(path))
+            return;
+        double start = now_ns();
+        for (int i = 0; i < n; i++)
+            history.append(commands[i % commands.size()] + " " + to_string(i), "/root/repo", 0, i, i);
+        report("history", "append", n, now_ns() - start);
+    }
+    History history;
+    double start = now_ns();
+    history.open(path);
+    report("history", "open", history.size(), now_ns() - start);
+    long found = 0;
+    start = now_ns();
+    for (int i = 0; i < 1000; i++)
+        found += history.findPrefix("make -j8 smash 4999", 19) + history.findPrefix("git st", 6);
+    report("history", "find_prefix_recent", 2000, now_ns() - start);
+    start = now_ns();
+    for (int i = 0; i < 100; i++)
+        found += history.findPrefix("rm", 2) + history.searchPrefix("git status 1").size();
+    report("history", "find_prefix_scan", 200, now_ns() - start);
+    start = now_ns();
+    for (int i = 0; i < 10; i++)
+        found += history.searchText("grep -v b 99").size();
+    report("history", "search_text", 10, now_ns() - start);
+    sink = found;
+    unlink(path);
+}
+
+// the scanning functions of the text filters over size bytes of log-like lines, named after the instruction set they
+// picked.
+static void benchTextScan(size_t size) {
+    string text;
+    mt19937 rng(size);
+    vector<string> words = {"GET", "/index.html", "200", "error", "timeout", "user=42", "\t", "latency_ms=17"};
+    while (text.size() < size) {
+        for (unsigned int i = 1 + rng() % 12; i > 0; i--)
+            text += words[rng() % words.size()] + ' ';
+        text.back() = '\n';
+    }
+    string isa = textScanIsa();
+    double start = now_ns();
+    long found = countByte(text.data(), text.size(), '\n');
+    reportBandwidth("text_scan", "count_lines_" + isa, text.size(), now_ns() - start);
+    bool in_word = false;
+    start = now_ns();
+    found += countWords(text.data(), text.size(), in_word);
+    reportBandwidth("text_scan", "count_words_" + isa, text.size(), now_ns() - start);
+    // a needle which is never there, so the whole text is searched.
+    start = now_ns();
+    found += (findSubstring(text.data(), text.size(), "latency_ms=99", 13) != nullptr);
+    reportBandwidth("text_scan", "find_substring_" + isa, text.size(), now_ns() - start);
+    start = now_ns();
+    found += (memmem(text.data(), text.size(), "latency_ms=99", 13) != nullptr);
+    reportBandwidth("text_scan", "find_substring_memmem", text.size(), now_ns() - start);
+    sink = found;
+}
+
+// ExternalSorter over size bytes of random lines: in memory with one thread and with one per cpu, then with a limit
+// of an eighth of the input, so runs are spilled to temporary files and merged.
+static void benchSort(size_t size) {
+    string text;
+    mt19937 rng(size);
+    while (text.size() < size)
+        text += to_string(rng()) + " line " + to_string(rng() % 1000) + '\n';
+    SortKeys keys;
+    ofstream null_out("/dev/null");
+    unsigned int cpus = ParallelCommand::cpuCount();
+    vector<pair<string, pair<size_t, unsigned int>>> configs = {
+            {"in_memory_1_thread", {SORT_MEMORY_DEFAULT, 1}},
+            {"in_memory_" + to_string(cpus) + "_threads", {SORT_MEMORY_DEFAULT, cpus}},
+            {"spilled_" + to_string(cpus) + "_threads", {size / 8, cpus}}};
+    for (auto &config : configs) {
+        double start = now_ns();
+        ExternalSorter sorter(keys, config.second.first, config.second.second, ParallelCommand::openCaptureFile);
+        // blocks of whole lines, like LineBlockReader hands them out. the text ends with a newline.
+        for (size_t pos = 0, end; pos < text.size(); pos = end) {
+            end = text.find('\n', min(text.size(), pos + TEXT_BLOCK_SIZE) - 1) + 1;
+            sorter.add(text.data() + pos, end - pos);
+        }
+        sorter.finish(null_out);
+        null_out.flush();
+        reportBandwidth("sort", config.first, text.size(), now_ns() - start);
+        sink = sorter.stats.runs;
+    }
+}
+
+// launching /bin/true and waiting for it to exit, n times with every launcher backend.
+static void benchLaunch(int n) {
+    SmallShell &smash = SmallShell::getInstance();
+    LaunchSpec spec;
+    spec.path = "/bin/true";
+    spec.args = {"/bin/true"};
+    LaunchBackend saved_backend = smash.launcher.backend;
+    for (LaunchBackend backend : {LAUNCH_FORK, LAUNCH_SPAWN}) {
+        smash.launcher.backend = backend;
+        vector<double> samples;
+        for (int i = 0; i < n; i++) {
+            double start = now_ns();
+            int pid = smash.launcher.launch(spec);
+            if (pid < 0)
+                break;
+            smash.event_loop.waitForeground(pid);
+            samples.push_back(now_ns() - start);
+        }
+        if (!samples.empty())
+            reportLatency("launch", Launcher::backendName(backend), samples);
+    }
+    smash.launcher.backend = saved_backend;
+}
+
+// pushing a file through pipelines of /bin/cat with a growing number of stages.
+static void benchPipeline(size_t size) {
+    SmallShell &smash = SmallShell::getInstance();
+    string path = makeDataFile(size);
+    if (path.empty())
+        return;
+    for (int num_of_stages : {2, 4, 8}) {
+        string line = "/bin/cat " + path;
+        for (int i = 1; i < num_of_stages; i++)
+            line += " | /bin/cat";
+        line += " > /dev/null";
+        double start = now_ns();
+        smash.executeCommand(line);
+        reportBandwidth("pipeline", to_string(num_of_stages) + "_stages", size, now_ns() - start);
+    }
+    unlink(path.c_str());
+}
+
+// cat's copy of a file to another file and to /dev/null, named after the method the kernel took.
+static void benchCat(size_t size) {
+    string path = makeDataFile(size);
+    if (path.empty())
+        return;
+    char out_path[] = "/tmp/smash-bench-out-XXXXXX";
+    int out_fd = mkstemp(out_path);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (out_fd == -1 || null_fd == -1) {
+        perror("smash error: open failed");
+    } else {
+        for (int dest_fd : {out_fd, null_fd}) {
+            int in_fd = open(path.c_str(), O_RDONLY);
+            if (in_fd == -1) {
+                perror("smash error: open failed");
+                break;
+            }
+            CopyMethod method;
+            double start = now_ns();
+            ssize_t copied = CatCommand::copyFd(in_fd, dest_fd, BUFFER_SIZE, method);
+            double total_ns = now_ns() - start;
+            close(in_fd);
+            if (copied >= 0)
+                reportBandwidth("cat", string(dest_fd == out_fd ? "file_" : "null_") + CatCommand::methodName(method),
+                                copied, total_ns);
+        }
+    }
+    if (out_fd != -1) {
+        close(out_fd);
+        unlink(out_path);
+    }
+    if (null_fd != -1)
+        close(null_fd);
+    unlink(path.c_str());
+}
+
+int main(int argc, char *argv[]) {
+    for (int n : {1000, 10000, 100000})
+        benchJobs(n);
+    benchParser(100000);
+    benchDispatch(100000);
+    benchInput(1000000);
+    benchHistory(500000);
+    benchTextScan(256 * 1024 * 1024);
+    benchSort(16 * 1024 * 1024);
+    // the suites below run real children, which the event loop waits for.
+    SmallShell::getInstance().event_loop.init(-1);
+    benchLaunch(1000);
+    benchPipeline(64 * 1024 * 1024);
+    benchCat(256 * 1024 * 1024);
+    return 0;
+}
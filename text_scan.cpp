@@ -0,0 +1,379 @@
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TEXT_SCAN_X86
+#endif
+#include "text_scan.h"
+#include "Commands.h"
+
+using namespace std;
+
+// ***********************************************************************************************************************************
+// **********************************                SCALAR                        ***************************************************
+// ***********************************************************************************************************************************
+
+static inline bool isSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static size_t countByteScalar(const char *data, size_t length, char c) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++)
+        count += (data[i] == c);
+    return count;
+}
+
+static size_t countWordsScalar(const char *data, size_t length, bool &in_word) {
+    size_t count = 0;
+    for (size_t i = 0; i < length; i++) {
+        bool space = isSpace(data[i]);
+        count += (!space && !in_word);
+        in_word = !space;
+    }
+    return count;
+}
+
+static const char *findSubstringScalar(const char *data, size_t length, const char *needle, size_t needle_length) {
+    return static_cast<const char *>(memmem(data, length, needle, needle_length));
+}
+
+#ifdef TEXT_SCAN_X86
+
+// ***********************************************************************************************************************************
+// **********************************                SSE2                          ***************************************************
+// ***********************************************************************************************************************************
+
+// byte counters are summed into 64 bit lanes before 255 blocks could overflow them.
+static size_t countByteSse2(const char *data, size_t length, char c) {
+    const __m128i target = _mm_set1_epi8(c);
+    size_t count = 0, i = 0;
+    while (i + 16 <= length) {
+        __m128i counters = _mm_setzero_si128();
+        for (int blocks = 0; blocks < 255 && i + 16 <= length; blocks++, i += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(block, target));
+        }
+        __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+        count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums));
+    }
+    return count + countByteScalar(data + i, length - i, c);
+}
+
+// a bit per byte which is a space: ' ', or \t to \r, which are the only bytes b with b - 9 <= 4 unsigned.
+static inline unsigned int spaceMaskSse2(__m128i block) {
+    __m128i shifted = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+    __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+    __m128i blank = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+    return _mm_movemask_epi8(_mm_or_si128(control, blank));
+}
+
+// a word starts at every byte which is not a space and comes after one.
+static size_t countWordsSse2(const char *data, size_t length, bool &in_word) {
+    size_t count = 0, i = 0;
+    unsigned int space_before = !in_word;
+    for (; i + 16 <= length; i += 16) {
+        unsigned int spaces = spaceMaskSse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)));
+        unsigned int starts = ~spaces & ((spaces << 1) | space_before) & 0xffff;
+        count += __builtin_popcount(starts);
+        space_before = (spaces >> 15) & 1;
+    }
+    in_word = !space_before;
+    return count + countWordsScalar(data + i, length - i, in_word);
+}
+
+// candidates are the positions where both the first and the last byte of the needle match, 16 at a time. only those
+// are compared in full.
+static const char *findSubstringSse2(const char *data, size_t length, const char *needle, size_t needle_length) {
+    if (needle_length < 2 || needle_length > length)
+        return findSubstringScalar(data, length, needle, needle_length);
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+    size_t i = 0;
+    for (; i + needle_length - 1 + 16 <= length; i += 16) {
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + needle_length - 1));
+        unsigned int candidates = _mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+        while (candidates != 0) {
+            unsigned int bit = __builtin_ctz(candidates);
+            if (memcmp(data + i + bit + 1, needle + 1, needle_length - 2) == 0)
+                return data + i + bit;
+            candidates &= candidates - 1;
+        }
+    }
+    return findSubstringScalar(data + i, length - i, needle, needle_length);
+}
+
+// ***********************************************************************************************************************************
+// **********************************                AVX2                          ***************************************************
+// ***********************************************************************************************************************************
+
+__attribute__((target("avx2")))
+static size_t countByteAvx2(const char *data, size_t length, char c) {
+    const __m256i target = _mm256_set1_epi8(c);
+    size_t count = 0, i = 0;
+    while (i + 32 <= length) {
+        __m256i counters = _mm256_setzero_si256();
+        for (int blocks = 0; blocks < 255 && i + 32 <= length; blocks++, i += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(block, target));
+        }
+        __m256i sums = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+        count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) + _mm256_extract_epi64(sums, 2) +
+                 _mm256_extract_epi64(sums, 3);
+    }
+    return count + countByteSse2(data + i, length - i, c);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t countWordsAvx2(const char *data, size_t length, bool &in_word) {
+    size_t count = 0, i = 0;
+    uint64_t space_before = !in_word;
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i shifted = _mm256_sub_epi8(block, _mm256_set1_epi8('\t'));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+        __m256i blank = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' '));
+        uint64_t spaces = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(control, blank));
+        uint64_t starts = ~spaces & ((spaces << 1) | space_before) & 0xffffffffu;
+        count += _mm_popcnt_u64(starts);
+        space_before = (spaces >> 31) & 1;
+    }
+    in_word = !space_before;
+    return count + countWordsSse2(data + i, length - i, in_word);
+}
+
+__attribute__((target("avx2")))
+static const char *findSubstringAvx2(const char *data, size_t length, const char *needle, size_t needle_length) {
+    if (needle_length < 2 || needle_length > length)
+        return findSubstringScalar(data, length, needle, needle_length);
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+    size_t i = 0;
+    for (; i + needle_length - 1 + 32 <= length; i += 32) {
+        __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + needle_length - 1));
+        uint32_t candidates = _mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+        while (candidates != 0) {
+            unsigned int bit = __builtin_ctz(candidates);
+            if (memcmp(data + i + bit + 1, needle + 1, needle_length - 2) == 0)
+                return data + i + bit;
+            candidates &= candidates - 1;
+        }
+    }
+    return findSubstringSse2(data + i, length - i, needle, needle_length);
+}
+
+#endif
+
+// ***********************************************************************************************************************************
+// **********************************                DISPATCH                      ***************************************************
+// ***********************************************************************************************************************************
+
+class ScanFunctions {
+public:
+    const char *isa;
+    size_t (*count_byte)(const char *, size_t, char);
+    size_t (*count_words)(const char *, size_t, bool &);
+    const char *(*find_substring)(const char *, size_t, const char *, size_t);
+};
+
+static ScanFunctions pickScanFunctions() {
+#ifdef TEXT_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        return {"avx2", countByteAvx2, countWordsAvx2, findSubstringAvx2};
+    if (__builtin_cpu_supports("sse2"))
+        return {"sse2", countByteSse2, countWordsSse2, findSubstringSse2};
+#endif
+    return {"scalar", countByteScalar, countWordsScalar, findSubstringScalar};
+}
+
+static const ScanFunctions &scanFunctions() {
+    static const ScanFunctions functions = pickScanFunctions();
+    return functions;
+}
+
+const char *textScanIsa() {
+    return scanFunctions().isa;
+}
+
+size_t countByte(const char *data, size_t length, char c) {
+    return scanFunctions().count_byte(data, length, c);
+}
+
+size_t countWords(const char *data, size_t length, bool &in_word) {
+    return scanFunctions().count_words(data, length, in_word);
+}
+
+const char *findSubstring(const char *data, size_t length, const char *needle, size_t needle_length) {
+    if (needle_length == 0)
+        return data;
+    if (needle_length == 1)
+        return static_cast<const char *>(memchr(data, needle[0], length));
+    return scanFunctions().find_substring(data, length, needle, needle_length);
+}
+
+// ***********************************************************************************************************************************
+// **********************************                LINE BLOCKS                   ***************************************************
+// ***********************************************************************************************************************************
+
+bool LineBlockReader::next(const char *&data, size_t &length) {
+    // the partial line left over from the last block moves to the front.
+    if (begin > 0) {
+        memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+    }
+    while (!at_eof) {
+        if (end == buffer.size())
+            buffer.resize(buffer.size() * 2);
+        ssize_t count = read(fd, buffer.data() + end, buffer.size() - end);
+        if (count == -1 && errno == EINTR)
+            continue;
+        if (count == -1) {
+            smashPerror("smash error: read failed");
+            failed = true;
+        }
+        if (count <= 0) {
+            at_eof = true;
+            break;
+        }
+        // the data before this read has no newline, so the last one, if any, is in what was just read.
+        const char *last_newline = static_cast<const char *>(memrchr(buffer.data() + end, '\n', count));
+        end += count;
+        if (last_newline != nullptr) {
+            data = buffer.data();
+            length = begin = last_newline + 1 - buffer.data();
+            return true;
+        }
+    }
+    if (end == 0)
+        return false;
+    data = buffer.data();
+    length = begin = end;
+    return true;
+}
+
+// ***********************************************************************************************************************************
+// **********************************                GREP PATTERNS                 ***************************************************
+// ***********************************************************************************************************************************
+
+bool GrepPattern::compile(const string &pattern, bool ignore_case, bool fixed) {
+    atoms.clear();
+    anchor_begin = anchor_end = false;
+    pattern_text.clear();
+    size_t i = 0, length = pattern.size();
+    if (!fixed && i < length && pattern[i] == '^') {
+        anchor_begin = true;
+        i++;
+    }
+    while (i < length) {
+        char c = pattern[i];
+        Atom atom {ATOM_CHAR, false, c, {}};
+        if (fixed) {
+            i++;
+        } else if (c == '$' && i + 1 == length) {
+            anchor_end = true;
+            break;
+        } else if (c == '*' && !atoms.empty()) {
+            // a * after a * adds nothing.
+            atoms.back().star = true;
+            i++;
+            continue;
+        } else if (c == '.') {
+            atom.type = ATOM_ANY;
+            i++;
+        } else if (c == '[') {
+            atom.type = ATOM_SET;
+            size_t pos = i + 1;
+            bool negated = (pos < length && pattern[pos] == '^');
+            pos += negated;
+            // a ] right after the [ or [^ is a member.
+            size_t first_member = pos;
+            while (pos < length && (pattern[pos] != ']' || pos == first_member)) {
+                unsigned char from = pattern[pos], to = from;
+                if (pos + 2 < length && pattern[pos + 1] == '-' && pattern[pos + 2] != ']') {
+                    to = pattern[pos + 2];
+                    pos += 2;
+                }
+                for (unsigned int member = from; member <= to; member++)
+                    atom.set[member] = true;
+                pos++;
+            }
+            if (pos == length)
+                return false;
+            // with -i a member stands for both of its cases, which has to hold before [^...] is negated.
+            if (ignore_case) {
+                for (int member = 'a'; member <= 'z'; member++) {
+                    if (atom.set[member] || atom.set[toupper(member)])
+                        atom.set[member] = atom.set[toupper(member)] = true;
+                }
+            }
+            if (negated)
+                atom.set.flip();
+            i = pos + 1;
+        } else if (c == '\\') {
+            if (i + 1 == length)
+                return false;
+            atom.c = pattern[i + 1];
+            i += 2;
+        } else {
+            i++;
+        }
+        atoms.push_back(atom);
+    }
+    for (Atom &atom : atoms) {
+        if (!ignore_case)
+            break;
+        if (atom.type == ATOM_CHAR && tolower(atom.c) != toupper(atom.c)) {
+            atom.type = ATOM_SET;
+            atom.set[tolower(atom.c)] = atom.set[toupper(atom.c)] = true;
+        }
+    }
+    literal = !anchor_begin && !anchor_end;
+    for (const Atom &atom : atoms) {
+        literal = literal && atom.type == ATOM_CHAR && !atom.star && atom.c != '\n';
+        pattern_text.push_back(atom.c);
+    }
+    return true;
+}
+
+bool GrepPattern::matchHere(size_t atom, const char *pos, const char *end) const {
+    for (; atom < atoms.size(); atom++) {
+        const Atom &current = atoms[atom];
+        if (current.star) {
+            const char *longest = pos;
+            while (longest < end && current.accepts(*longest))
+                longest++;
+            for (const char *rest = longest; rest > pos; rest--) {
+                if (matchHere(atom + 1, rest, end))
+                    return true;
+            }
+            continue;
+        }
+        if (pos == end || !current.accepts(*pos))
+            return false;
+        pos++;
+    }
+    return !anchor_end || pos == end;
+}
+
+bool GrepPattern::matches(const char *line, size_t length) const {
+    if (literal)
+        return findSubstring(line, length, pattern_text.data(), pattern_text.size()) != nullptr;
+    const char *end = line + length;
+    if (anchor_begin)
+        return matchHere(0, line, end);
+    for (const char *start = line; start <= end; start++) {
+        if (matchHere(0, start, end))
+            return true;
+    }
+    return false;
+}
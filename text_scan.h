@@ -0,0 +1,96 @@
+#ifndef SMASH_TEXT_SCAN_H_
+#define SMASH_TEXT_SCAN_H_
+
+#include <string>
+#include <vector>
+#include <bitset>
+#include <stddef.h>
+
+#define TEXT_BLOCK_SIZE (128 * 1024) // the text filters read their input in blocks of at least this size.
+
+// the scanning functions below run with the widest vectors the cpu has: avx2, then sse2, then plain loops. which one
+// is picked once, the first time any of them is called.
+
+// "avx2", "sse2" or "scalar".
+const char *textScanIsa();
+
+// how many times c is in data[0, length).
+size_t countByte(const char *data, size_t length, char c);
+
+// how many words start in data[0, length), a word being a run of bytes which are not space, \t, \n, \v, \f or \r,
+// the way wc counts them. in_word says whether the byte before data was in a word, and is updated for the next call.
+size_t countWords(const char *data, size_t length, bool &in_word);
+
+// the first occurrence of needle in data[0, length), or nullptr.
+const char *findSubstring(const char *data, size_t length, const char *needle, size_t needle_length);
+
+// reads an fd in large blocks and hands out the whole lines of each one, so a filter goes over a block in one pass
+// instead of a line at a time. a partial line at the end of a block waits for the next read. a line longer than the
+// buffer grows it.
+class LineBlockReader {
+public:
+    explicit LineBlockReader(int fd) : failed(false), fd(fd), buffer(TEXT_BLOCK_SIZE), begin(0), end(0),
+                                       at_eof(false) {};
+
+    // the next run of whole lines, newlines included. the last line of the input may have none. data is valid until
+    // the next call. returns false at the end of the input.
+    bool next(const char *&data, size_t &length);
+
+    bool failed; // a read failed, which ended the input early.
+
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t begin; // buffer[begin, end) was not handed out yet.
+    size_t end;
+    bool at_eof;
+};
+
+// a grep pattern. one without special characters is searched for as it is over whole blocks. anything else is a basic
+// regular expression of ., *, ^, $, [...] and \, matched a line at a time.
+class GrepPattern {
+public:
+    GrepPattern() : literal(true), anchor_begin(false), anchor_end(false) {};
+
+    // fixed takes the whole pattern literally. returns false when the pattern is not valid.
+    bool compile(const std::string &pattern, bool ignore_case, bool fixed);
+
+    // a plain string, so findSubstring finds the matches.
+    bool isLiteral() const {
+        return literal;
+    }
+
+    const std::string &text() const {
+        return pattern_text;
+    }
+
+    // whether the line (without its newline) matches.
+    bool matches(const char *line, size_t length) const;
+
+private:
+    enum AtomType {
+        ATOM_CHAR, ATOM_ANY, ATOM_SET
+    };
+
+    class Atom {
+    public:
+        AtomType type;
+        bool star; // any number of it, longest first.
+        char c;
+        std::bitset<256> set;
+
+        bool accepts(char byte) const {
+            return type == ATOM_ANY || (type == ATOM_CHAR ? byte == c : set[(unsigned char) byte]);
+        }
+    };
+
+    bool literal;
+    bool anchor_begin;
+    bool anchor_end;
+    std::string pattern_text;
+    std::vector<Atom> atoms;
+
+    bool matchHere(size_t atom, const char *pos, const char *end) const;
+};
+
+#endif //SMASH_TEXT_SCAN_H_